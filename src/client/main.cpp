@@ -36,6 +36,8 @@ void printMenu()
 	std::cout << "2. list_all" << std::endl;
 	std::cout << "3. match" << std::endl;
 	std::cout << "4. logout" << std::endl;
+	std::cout << "5. nearby" << std::endl;
+	std::cout << "6. match in your region" << std::endl;
 	std::cout << "Your choice: " << std::flush;
 }
 
@@ -179,7 +181,7 @@ public:
 			catch(...)
 			{
 				std::unique_lock<Mutex> guard(mutex);
-				std::cout << "Invalid choice. Please enter a number between 1 and 4" << std::endl;
+				std::cout << "Invalid choice. Please enter a number between 1 and 6" << std::endl;
 				continue;
 			}
 			switch (choice)
@@ -202,6 +204,12 @@ public:
 							cv.wait(guard);
 					}
 					return;
+				case 5:
+					nearbyRequest();
+					break;
+				case 6:
+					_tcp.sendRequest("match,region\n");
+					break;
 				default:
 					std::unique_lock<Mutex> guard(mutex);
 					std::cout << "Invalid option." << std::endl;
@@ -221,7 +229,7 @@ public:
 			std::getline(std::cin, input);
 			command += input;
 			command += ',';
-			std::cout << "Country: " << std::flush;
+			std::cout << "Country (ISO code, e.g. IR): " << std::flush;
 			std::getline(std::cin, input);
 			command += input;
 			command += ',';
@@ -233,6 +241,30 @@ public:
 
 		_tcp.sendRequest(command);
 	}
+
+	void nearbyRequest()
+	{
+		std::string command = "nearby,";
+
+		{
+			std::unique_lock<Mutex> guard(mutex);
+
+			std::cout << "Number of players: " << std::flush;
+			std::string input;
+			std::getline(std::cin, input);
+			command += input;
+			std::cout << "Rating range (empty for any): " << std::flush;
+			std::getline(std::cin, input);
+			if (!input.empty())
+			{
+				command += ',';
+				command += input;
+			}
+			command += '\n';
+		}
+
+		_tcp.sendRequest(command);
+	}
 private:
 	TcpClient& _tcp;
 };
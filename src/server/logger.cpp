@@ -0,0 +1,281 @@
+#include "logger.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <ostream>
+
+namespace
+{
+	std::int64_t nowMicroseconds()
+	{
+		using namespace std::chrono;
+		return duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+	}
+
+	void copyField(char* dst, std::size_t size, const char* src)
+	{
+		if (src == nullptr)
+		{
+			dst[0] = '\0';
+			return;
+		}
+		std::strncpy(dst, src, size - 1);
+		dst[size - 1] = '\0';
+	}
+
+	//Like copyField, for values printed without quotes: spaces and control characters are replaced
+	void copyToken(char* dst, std::size_t size, const char* src)
+	{
+		copyField(dst, size, src);
+		for (; *dst != '\0'; ++dst)
+		{
+			//char may be signed or not
+			const auto c = static_cast<unsigned char>(*dst);
+			if (c <= ' ' || c >= 0x7f)
+				*dst = '?';
+		}
+	}
+
+	const char* const level_names[] = {"debug", "info", "warning", "error", "off"};
+}
+
+bool parseLogLevel(const std::string& text, LogLevel& level)
+{
+	for (std::size_t i = 0; i < sizeof(level_names) / sizeof(level_names[0]); ++i)
+	{
+		if (text == level_names[i])
+		{
+			level = static_cast<LogLevel>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* logLevelName(LogLevel level)
+{
+	return level_names[static_cast<std::size_t>(level)];
+}
+
+Logger& Logger::instance()
+{
+	static Logger instance;
+	return instance;
+}
+
+Logger::Logger() :
+	_enqueue_pos(0),
+	_dequeue_pos(0),
+	_level(LogLevel::Info),
+	_running(false),
+	_writer_idle(false),
+	_dropped(0),
+	_os(nullptr)
+{
+	for (std::size_t i = 0; i < capacity; ++i)
+		_ring[i].sequence.store(i, std::memory_order_relaxed);
+	for (auto& limiter : _limiters)
+	{
+		limiter.event.store(nullptr, std::memory_order_relaxed);
+		limiter.window.store(0, std::memory_order_relaxed);
+		limiter.count.store(0, std::memory_order_relaxed);
+		limiter.suppressed.store(0, std::memory_order_relaxed);
+	}
+}
+
+Logger::~Logger()
+{
+	stop();
+}
+
+void Logger::start(std::ostream& os)
+{
+	if (_running.exchange(true))
+		return;
+	_os = &os;
+	_writer = std::thread([this](){writerLoop();});
+}
+
+void Logger::stop()
+{
+	if (!_running.exchange(false))
+		return;
+	wake();
+	_writer.join();
+}
+
+bool Logger::push(const LogRecord& record)
+{
+	auto pos = _enqueue_pos.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		auto& slot = _ring[pos & (capacity - 1)];
+		const auto seq = slot.sequence.load(std::memory_order_acquire);
+		const auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+		if (diff == 0)
+		{
+			if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				slot.record = record;
+				slot.sequence.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+		}
+		else if (diff < 0)
+			return false;	//Full
+		else
+			pos = _enqueue_pos.load(std::memory_order_relaxed);
+	}
+}
+
+bool Logger::hasRecord() const
+{
+	const auto seq = _ring[_dequeue_pos & (capacity - 1)].sequence.load(std::memory_order_acquire);
+	return static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(_dequeue_pos + 1) >= 0;
+}
+
+//Taking the mutex makes sure the writer either hasn't checked the ring yet or is waiting
+void Logger::wake()
+{
+	{
+		std::lock_guard<std::mutex> guard(_wake_mutex);
+	}
+	_wake.notify_one();
+}
+
+bool Logger::pop(LogRecord& record)
+{
+	//Only the writer thread pops, so the dequeue position needs no atomics
+	auto& slot = _ring[_dequeue_pos & (capacity - 1)];
+	const auto seq = slot.sequence.load(std::memory_order_acquire);
+	if (static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(_dequeue_pos + 1) < 0)
+		return false;
+	record = slot.record;
+	slot.sequence.store(_dequeue_pos + capacity, std::memory_order_release);
+	++_dequeue_pos;
+	return true;
+}
+
+//Allows at most max_per_second records per event and per second. Events are identified
+//by the address of their string literal, hashed into a small table. On a collision with
+//another event the record is let through instead of being rate limited.
+bool Logger::rateLimited(const char* event, const std::int64_t now_us, std::uint32_t& suppressed)
+{
+	const auto hash = reinterpret_cast<std::uintptr_t>(event) >> 3;
+	auto& limiter = _limiters[hash & (limiter_slots - 1)];
+
+	const char* expected = nullptr;
+	if (!limiter.event.compare_exchange_strong(expected, event) && expected != event)
+		return false;
+
+	const auto window = now_us / 1000000;
+	auto current = limiter.window.load(std::memory_order_relaxed);
+	if (current != window && limiter.window.compare_exchange_strong(current, window))
+		limiter.count.store(0, std::memory_order_relaxed);
+
+	if (limiter.count.fetch_add(1, std::memory_order_relaxed) >= max_per_second)
+	{
+		limiter.suppressed.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+	suppressed = limiter.suppressed.exchange(0, std::memory_order_relaxed);
+	return false;
+}
+
+void Logger::log(const LogLevel level, const char* event, const std::uint64_t session, const char* command,
+		const char* detail, const std::int64_t value)
+{
+	if (!enabled(level))
+		return;
+
+	LogRecord record;
+	record.time_us    = nowMicroseconds();
+	record.suppressed = 0;
+
+	if (level >= LogLevel::Warning && rateLimited(event, record.time_us, record.suppressed))
+		return;
+
+	record.event   = event;
+	record.session = session;
+	record.value   = value;
+	record.level   = level;
+	copyToken(record.command, sizeof(record.command), command);
+	copyField(record.detail, sizeof(record.detail), detail);
+
+	if (!push(record))
+	{
+		_dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	//Pairs with the fence in writerLoop: either the writer sees the record or we see it idle
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (_writer_idle.load(std::memory_order_relaxed))
+		wake();
+}
+
+void Logger::writerLoop()
+{
+	LogRecord record;
+	std::uint64_t reported_drops = 0;
+
+	const auto drain = [&]()
+	{
+		bool wrote = false;
+		while (pop(record))
+		{
+			write(record);
+			wrote = true;
+		}
+		const auto drops = _dropped.load(std::memory_order_relaxed);
+		if (drops != reported_drops)
+		{
+			*_os << "level=warning event=log_overflow dropped=" << drops - reported_drops << '\n';
+			reported_drops = drops;
+			wrote = true;
+		}
+		//One flush per batch instead of one per line
+		if (wrote)
+			_os->flush();
+		return wrote;
+	};
+
+	while (_running.load(std::memory_order_relaxed))
+	{
+		if (drain())
+			continue;
+		std::unique_lock<std::mutex> guard(_wake_mutex);
+		_writer_idle.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		//The timeout only bounds how late dropped records are reported
+		if (!hasRecord() && _running.load(std::memory_order_relaxed))
+			_wake.wait_for(guard, std::chrono::seconds(1));
+		_writer_idle.store(false, std::memory_order_relaxed);
+	}
+	drain();
+}
+
+void Logger::write(const LogRecord& record)
+{
+	const std::time_t seconds = record.time_us / 1000000;
+	std::tm tm;
+	gmtime_r(&seconds, &tm);
+
+	auto& os = *_os;
+	os << std::put_time(&tm, "%Y-%m-%dT%H:%M:%S") << '.' << std::setfill('0') << std::setw(6)
+		<< record.time_us % 1000000 << std::setfill(' ') << "Z level=" << logLevelName(record.level)
+		<< " event=" << record.event;
+	if (record.session != 0)
+		os << " session=" << record.session;
+	if (record.command[0] != '\0')
+		os << " command=" << record.command;
+	if (record.value != 0)
+		os << " value=" << record.value;
+	if (record.suppressed != 0)
+		os << " suppressed=" << record.suppressed;
+	if (record.detail[0] != '\0')
+		os << " detail=\"" << record.detail << '"';
+	os << '\n';
+}
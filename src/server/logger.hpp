@@ -0,0 +1,122 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+enum class LogLevel : std::uint8_t
+{
+	Debug,
+	Info,
+	Warning,
+	Error,
+	Off
+};
+
+bool parseLogLevel(const std::string& text, LogLevel& level);
+const char* logLevelName(LogLevel level);
+
+//A fixed-size binary record. Call sites never format anything: they copy a few
+//scalars and short strings into a slot of the ring and the writer thread does the rest.
+struct LogRecord
+{
+	std::int64_t  time_us;		//Microseconds since epoch (system clock)
+	const char*   event;		//Must point to a string literal
+	std::uint64_t session;		//0 if the record is not tied to a session
+	std::int64_t  value;
+	std::uint32_t suppressed;	//Records of the same event dropped by the rate limiter
+	LogLevel      level;
+	char          command[15];
+	char          detail[64];
+};
+
+//Asynchronous logger: producers push records into a bounded lock-free ring (Vyukov's
+//MPMC queue used with a single consumer) and a background thread writes them in batches.
+//A full ring drops records instead of blocking the event loop. An idle writer sleeps until a
+//producer finds it idle after a push and wakes it up.
+class Logger
+{
+public:
+	static Logger& instance();
+
+	void start(std::ostream& os);
+	void stop();
+
+	void setLevel(LogLevel level) {_level.store(level, std::memory_order_relaxed);}
+	bool enabled(LogLevel level) const
+	{
+		return _running.load(std::memory_order_relaxed) && level >= _level.load(std::memory_order_relaxed) && level != LogLevel::Off;
+	}
+
+	void log(LogLevel level, const char* event, std::uint64_t session = 0, const char* command = nullptr,
+			const char* detail = nullptr, std::int64_t value = 0);
+	void log(LogLevel level, const char* event, std::uint64_t session, const char* command,
+			const std::string& detail, std::int64_t value = 0)
+	{
+		log(level, event, session, command, detail.c_str(), value);
+	}
+
+	std::uint64_t dropped() const {return _dropped.load(std::memory_order_relaxed);}
+
+	~Logger();
+private:
+	Logger();
+	bool push(const LogRecord& record);
+	bool pop(LogRecord& record);
+	bool hasRecord() const;
+	void wake();
+	bool rateLimited(const char* event, std::int64_t now_us, std::uint32_t& suppressed);
+	void writerLoop();
+	void write(const LogRecord& record);
+
+	static constexpr std::size_t capacity      = 8192;	//Must be a power of two
+	static constexpr std::size_t limiter_slots = 64;	//Must be a power of two
+	static constexpr std::uint32_t max_per_second = 20;	//Per event, for warnings and errors
+
+	struct Slot
+	{
+		std::atomic<std::size_t> sequence;
+		LogRecord record;
+	};
+
+	struct Limiter
+	{
+		std::atomic<const char*>   event;
+		std::atomic<std::int64_t>  window;	//Current one second window
+		std::atomic<std::uint32_t> count;
+		std::atomic<std::uint32_t> suppressed;
+	};
+
+	std::array<Slot, capacity> _ring;
+	alignas(64) std::atomic<std::size_t> _enqueue_pos;
+	alignas(64) std::size_t _dequeue_pos;
+
+	std::array<Limiter, limiter_slots> _limiters;
+
+	std::atomic<LogLevel> _level;
+	std::atomic<bool> _running;
+	std::atomic<bool> _writer_idle;
+	std::mutex _wake_mutex;
+	std::condition_variable _wake;
+	std::atomic<std::uint64_t> _dropped;
+	std::ostream* _os;
+	std::thread _writer;
+};
+
+//Shorthand that doesn't touch the ring when the level is disabled. The arguments are still
+//evaluated: call sites on hot paths that build strings (e.g. error_code::message) check
+//Logger::enabled first.
+template <class... Args>
+inline void logEvent(LogLevel level, const char* event, Args&&... args)
+{
+	auto& logger = Logger::instance();
+	if (logger.enabled(level))
+		logger.log(level, event, std::forward<Args>(args)...);
+}
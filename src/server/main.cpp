@@ -4,17 +4,134 @@
 #include <iostream>
 #include <boost/asio.hpp>
 #include <boost/optional.hpp>
+#include <boost/program_options.hpp>
 
 #include "server.hpp"
+#include "logger.hpp"
+#include "manager.hpp"
+#include "preload.hpp"
+#include "stall_detector.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
 
 void print(const boost::system::error_code&)
 {
 	std::cout << "Hello there!" << std::endl;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
-	Server::instance().run();
+	namespace po = boost::program_options;
+
+	std::string log_level;
+	std::string preload_path;
+	std::string snapshot_path;
+	unsigned preload_threads;
+	unsigned stall_threshold_ms;
+	unsigned stall_probe_ms;
+	unsigned stall_report_interval;
+	std::string stall_report_path;
+	std::string unix_socket_path;
+	po::options_description desc("Options");
+	desc.add_options()
+		("help,h", "Print this help message")
+		("log-level", po::value<std::string>(&log_level)->default_value("info"), "debug, info, warning, error or off")
+		("preload", po::value<std::string>(&preload_path), "Register the players of a CSV (login layout) or snapshot file before listening")
+		("preload-threads", po::value<unsigned>(&preload_threads)->default_value(std::max(1u, std::thread::hardware_concurrency())), "Threads parsing a CSV preload file")
+		("write-snapshot", po::value<std::string>(&snapshot_path), "Write the preloaded players as a snapshot file and exit")
+		("unix-socket", po::value<std::string>(&unix_socket_path), "Also accept sessions on this Unix domain socket")
+		("stall-threshold-ms", po::value<unsigned>(&stall_threshold_ms)->default_value(0), "Event loop lag and handler duration reported as a stall, 0 (the default) disables the stall detector")
+		("stall-probe-ms", po::value<unsigned>(&stall_probe_ms)->default_value(10), "Interval between event loop lag probes")
+		("stall-report", po::value<std::string>(&stall_report_path), "File where the lag histogram and the recent slow handlers are written")
+		("stall-report-interval", po::value<unsigned>(&stall_report_interval)->default_value(10), "Seconds between two stall reports");
+
+	po::variables_map vm;
+	try
+	{
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+		po::notify(vm);
+	}
+	catch (const po::error& e)
+	{
+		std::cerr << e.what() << std::endl << desc << std::endl;
+		return 1;
+	}
+	if (vm.count("help"))
+	{
+		std::cout << desc << std::endl;
+		return 0;
+	}
+
+	LogLevel level;
+	if (!parseLogLevel(log_level, level))
+	{
+		std::cerr << "Invalid log level: " << log_level << std::endl;
+		return 1;
+	}
+	auto& logger = Logger::instance();
+	logger.setLevel(level);
+	if (level != LogLevel::Off)
+		logger.start(std::cout);
+
+	if (!preload_path.empty())
+	{
+		try
+		{
+			const auto start = std::chrono::steady_clock::now();
+			const auto players = loadPlayerFile(preload_path, preload_threads);
+			PlayerList registered;
+			const auto loaded = Manager::instance().bulkLoad(players, snapshot_path.empty() ? nullptr : &registered);
+			const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+			if (logger.enabled(LogLevel::Info))
+				logger.log(LogLevel::Info, "preload_ms", 0, nullptr, std::to_string(loaded) + " players from " + preload_path, elapsed.count());
+
+			if (!snapshot_path.empty())
+			{
+				//Only the players the manager accepted, e.g. not the duplicates of a name
+				writeSnapshot(snapshot_path, registered);
+				logger.stop();
+				return 0;
+			}
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << e.what() << std::endl;
+			logger.stop();
+			return 1;
+		}
+	}
+	else if (!snapshot_path.empty())
+	{
+		std::cerr << "--write-snapshot requires --preload" << std::endl;
+		return 1;
+	}
+
+	auto& server = Server::instance();
+	if (!unix_socket_path.empty())
+	{
+		try
+		{
+			server.listenLocal(unix_socket_path);
+		}
+		catch (const boost::system::system_error& e)
+		{
+			std::cerr << "Cannot listen on " << unix_socket_path << ": " << e.what() << std::endl;
+			logger.stop();
+			return 1;
+		}
+	}
+	if (stall_threshold_ms != 0)
+	{
+		StallDetector::instance().start(server.ioContext(), std::chrono::milliseconds(std::max(1u, stall_probe_ms)),
+				std::chrono::milliseconds(stall_threshold_ms), stall_report_path, std::chrono::seconds(std::max(1u, stall_report_interval)));
+	}
+
+	server.run();
+	StallDetector::instance().stop();
+	logger.stop();
 	return 0;
 	boost::asio::io_context io;
 	boost::asio::steady_timer t(io, boost::asio::chrono::seconds(5));
@@ -1,39 +1,112 @@
 #pragma once
 
+#include <array>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <memory>
 #include <vector>
-#include <map>
-#include <set>
 #include <utility>
 
 #include "player.hpp"
+#include "rating_index.hpp"
+#include "matching_policy.hpp"
+#include "region.hpp"
 
 #include <boost/thread.hpp>
 
-class Manager
+//Results of the typed interface of the manager
+enum class Status
 {
+	Ok,
+	Waiting,		//No suitable opponent yet, the player waits for one
+	WaitingInRegion,	//No suitable opponent in the player's region yet, see matchPlayer
+	AlreadyLoggedIn,
+	AlreadyPaired,		//The opponent is the current pair
+	NotLoggedIn,
+	InvalidName,
+	InvalidCountry,
+	InvalidRating
+};
+
+struct MatchOutcome
+{
+	Status status;
+	std::shared_ptr<Player> opponent;	//Set if the player is paired
+};
+
+struct RatedPlayer
+{
+	std::string name;
+	std::size_t rating;
+};
+
+//RatingIndex and MatchingPolicy are described in rating_index.hpp and matching_policy.hpp.
+//Range is a RatingRange. The definitions live in manager_impl.hpp, so other specializations
+//than Manager can be instantiated by including it.
+template <class RatingIndex, class MatchingPolicy, class Range>
+class BasicManager
+{
+	static_assert(Range::max_rating <= UINT16_MAX, "Players store their rating in 16 bits");
 public:
 	using ArgList = std::vector<std::string>;
 
-	static Manager& instance();
+	static constexpr std::size_t max_nearby = 100;	//Upper bound of the count of nearby
+
+	static BasicManager& instance();
 	
-	Manager();
+	BasicManager();
 	void parseCsv(std::shared_ptr<Player> player, const std::string& line);
-	bool isOnline(const std::string& name);
-	bool hasMatch(const std::string& name);
-
-
-	std::string login(std::shared_ptr<Player>& player, const ArgList& args);
-	std::string listAll(std::shared_ptr<Player>& player, const ArgList& args);
-	std::string match(std::shared_ptr<Player>& player, const ArgList& args);
-	std::string logout(std::shared_ptr<Player>& player, const ArgList& args);
+	bool isOnline(PlayerName name);
+	bool hasMatch(PlayerName name);
+	//Registers players who aren't connected (e.g. read by loadPlayerFile) in one batch,
+	//under a single lock. They're online and single but they aren't matched with each other.
+	//Placeholders among them (see Player::isPlaceholder) are replaced by loginPlayer when a
+	//player logs in with their name.
+	//Players with a name that is already online or an invalid rating are skipped. Returns
+	//the number of registered players. If `loaded` isn't null they're appended to it.
+	std::size_t bulkLoad(const std::vector<std::shared_ptr<Player>>& players, std::vector<std::shared_ptr<Player>>* loaded = nullptr);
+
+
+	//Typed interface, used by the CSV commands below and by in-process callers (see
+	//matchmaking_api.hpp). The opponent is notified through Player::paired and
+	//Player::opponentLoggedOut.
+	MatchOutcome loginPlayer(const std::shared_ptr<Player>& player, const std::string& name, const std::string& country, std::size_t rating);
+	std::vector<RatedPlayer> onlinePlayers();
+	//Up to `count` players who are single or waiting for a match, closest to the rating of
+	//`player` first, within `range` of it. It walks outward from that rating instead of
+	//listing everyone, so its cost doesn't depend on the number of online players. Players
+	//waiting for an opponent of their region only aren't listed.
+	std::vector<RatedPlayer> nearbyPlayers(const std::shared_ptr<Player>& player, std::size_t count, std::size_t range = Range::max_rating);
+	//With `regional`, players of the same region (see region.hpp) are searched first. If there
+	//is none, the player waits for one of them (WaitingInRegion) until its fallback calls
+	//widenMatch. Meanwhile only players of its region, with or without `regional`, can pair
+	//with it. Players of an unknown region are matched globally.
+	MatchOutcome matchPlayer(const std::shared_ptr<Player>& player, bool regional = false);
+	//Widens the search of a player waiting in its region to a global one, as matchPlayer
+	//without `regional` does: the global wait list, the players of its own region waiting for
+	//a regional match, then the single players. Players of other regions waiting for a regional
+	//match aren't searched, they only accept their own region. If nobody is found the player
+	//waits in the global wait list. Both players are notified through Player::paired.
+	void widenMatch(const std::shared_ptr<Player>& player);
+	Status logoutPlayer(const std::shared_ptr<Player>& player);
+
+	Message login(std::shared_ptr<Player>& player, const ArgList& args);
+	Message listAll(std::shared_ptr<Player>& player, const ArgList& args);
+	Message nearby(std::shared_ptr<Player>& player, const ArgList& args);
+	Message match(std::shared_ptr<Player>& player, const ArgList& args);
+	Message logout(std::shared_ptr<Player>& player, const ArgList& args);
 
 private:
 	void init();
-	std::pair<bool, std::string> noThreadSafeFindMatch(const std::shared_ptr<Player>& player, bool onlyInWaitList) const;
-	void noThreadSafeUpdateMatchCaches(const std::shared_ptr<Player>& player, const std::string& opponent);
+	std::pair<bool, PlayerName> noThreadSafeFindMatch(const std::shared_ptr<Player>& player, bool onlyInWaitList, bool onlyInRegion = false) const;
+	void noThreadSafeUpdateMatchCaches(const std::shared_ptr<Player>& player, PlayerName opponent);
+	void noThreadSafeAddSingle(const Player& player);
+	void noThreadSafeAddWaiting(const Player& player, bool onlyInRegion);
+	void noThreadSafeRemoveAvailable(const Player& player);
+	//Every online user, by descending rating then by name. Listing everyone is rare: sorting
+	//then is cheaper than keeping an index of every online user.
+	std::vector<RatingEntry> noThreadSafeSortedOnline() const;
 
 	using Mutex = boost::shared_mutex;
 	using ReadLock = boost::shared_lock<Mutex>;
@@ -41,20 +114,38 @@ private:
 
 	Mutex _mutex;
 
-	using CommandHandler = std::function<std::string (std::shared_ptr<Player>&, const ArgList&)>;
+	using CommandHandler = std::function<Message (std::shared_ptr<Player>&, const ArgList&)>;
 	using CommandList = std::unordered_map<std::string, CommandHandler>;
 
-	using OnlineList = std::unordered_map<std::string, std::shared_ptr<Player>>;
-	using RateList = std::map<std::size_t, std::set<std::string>, std::greater<std::size_t>>;
-	using MatchList = std::unordered_map<std::string, std::string>;
+	//Every name in these containers is a view of the name of a player in _online_users
+	using OnlineList = std::unordered_map<PlayerName, std::shared_ptr<Player>, PlayerNameHash>;
+	using RateList = RatingIndex;
+	using MatchList = std::unordered_map<PlayerName, PlayerName, PlayerNameHash>;
+	using RegionRateLists = std::array<RateList, region_count>;
+	using NameSet = std::unordered_set<PlayerName, PlayerNameHash>;
+
+	//Logs the player out: its opponent is notified and it leaves every container
+	void noThreadSafeRemovePlayer(typename OnlineList::iterator iter);
 
 	OnlineList _online_users;	//All online users
 
-	RateList _online_rates;		//All online users
 	RateList _wait_list_rates;	//All users who are waiting for a match
 	RateList _singles_rates;	//All online users who don't request for a match
 
+	//The same users by region, for regional matching. Users of an unknown region aren't there.
+	RegionRateLists _region_wait_list_rates;	//Also has the users of _regional_waiters
+	RegionRateLists _region_singles_rates;
+	NameSet _regional_waiters;	//Users waiting in _region_wait_list_rates only, until widenMatch
+
 	MatchList _match_list;
 
 	CommandList _commands;
 };
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+constexpr std::size_t BasicManager<RatingIndex, MatchingPolicy, Range>::max_nearby;
+
+using DefaultRatingRange = RatingRange<100, 3000, 100>;
+using Manager = BasicManager<TreeRatingIndex, HighestRatingFirst, DefaultRatingRange>;
+
+extern template class BasicManager<TreeRatingIndex, HighestRatingFirst, DefaultRatingRange>;
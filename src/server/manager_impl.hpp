@@ -0,0 +1,586 @@
+#pragma once
+
+#include "manager.hpp"
+#include "logger.hpp"
+
+#include <functional>
+#include <algorithm>
+#include <iterator>
+
+namespace manager_detail
+{
+	const std::string login_usage    = "login,name,country,rate (country is an ISO 3166 alpha-2 code)";
+	const std::string list_all_usage = "list_all";
+	const std::string nearby_usage   = "nearby,count[,range] (count is at most 100)";
+	const std::string match_usage    = "match[,region]";
+	const std::string logout_usage   = "logout";
+
+	//The fixed parts of replies are shared by every message that uses them
+	const SharedBuffer logged_in       = makeBuffer("You've successfully logged in: ");
+	const SharedBuffer paired          = makeBuffer("You've paired with ");
+	const SharedBuffer also_paired     = makeBuffer("\nYou've paired with ");
+	const SharedBuffer already_paired  = makeBuffer("You cannot have more than 1 pair! Your current pair: ");
+	const SharedBuffer no_match        = makeBuffer("At the moment there is no suitable match. We'll let you know when one is avaialble in 60 seconds");
+	const SharedBuffer no_region_match = makeBuffer("At the moment there is no suitable match in your region. We'll look in other regions shortly");
+	const SharedBuffer logged_out      = makeBuffer("You've successfully logged out from the system: ");
+	const SharedBuffer already_logged  = makeBuffer("You've already logged in into the system!");
+
+	inline Message text(std::string message)
+	{
+		return Message{makeBuffer(std::move(message))};
+	}
+
+	//Unlike std::stoi it rejects signs, trailing characters and values that don't fit
+	inline bool parseCount(const std::string& text, std::size_t& value)
+	{
+		if (text.empty() || text.size() > 9 || !std::all_of(text.begin(), text.end(), [](char c) {return c >= '0' && c <= '9';}))
+			return false;
+		value = std::stoul(text);
+		return true;
+	}
+
+	//Like boost::split on ',' (empty fields are kept), in a single allocation of the token list
+	inline void splitCsv(const std::string& line, std::vector<std::string>& tokens)
+	{
+		tokens.reserve(std::count(line.begin(), line.end(), ',') + 1);
+		auto first = line.begin();
+		for (;;)
+		{
+			const auto last = std::find(first, line.end(), ',');
+			tokens.emplace_back(first, last);
+			if (last == line.end())
+				return;
+			first = last + 1;
+		}
+	}
+
+	inline Message invalidParameters(const std::string& usage)
+	{
+		return text("Invalid parameters. You should use " + usage);
+	}
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+BasicManager<RatingIndex, MatchingPolicy, Range>& BasicManager<RatingIndex, MatchingPolicy, Range>::instance()
+{
+	static BasicManager instance;
+	return instance;
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+BasicManager<RatingIndex, MatchingPolicy, Range>::BasicManager()
+{
+	init();
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+bool BasicManager<RatingIndex, MatchingPolicy, Range>::isOnline(const PlayerName name)
+{
+	ReadLock guard(_mutex);
+
+	return _online_users.find(name) != _online_users.end();
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+bool BasicManager<RatingIndex, MatchingPolicy, Range>::hasMatch(const PlayerName name)
+{
+	ReadLock guard(_mutex);
+
+	return _match_list.find(name) != _match_list.end();
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+std::size_t BasicManager<RatingIndex, MatchingPolicy, Range>::bulkLoad(const std::vector<std::shared_ptr<Player>>& players, std::vector<std::shared_ptr<Player>>* loaded)
+{
+	std::vector<RatingEntry> entries;
+	entries.reserve(players.size());
+	std::array<std::vector<RatingEntry>, region_count> region_entries;
+
+	WriteLock guard(_mutex);
+
+	_online_users.reserve(_online_users.size() + players.size());
+	if (loaded != nullptr)
+		loaded->reserve(loaded->size() + players.size());
+	for (const auto& player : players)
+	{
+		if (player->name().empty() || player->rating() > Range::max_rating)
+			continue;
+		if (!_online_users.emplace(player->name(), player).second)
+			continue;
+		if (loaded != nullptr)
+			loaded->push_back(player);
+		entries.emplace_back(player->rating(), player->name());
+		const auto region = regionOf(player->countryCode());
+		if (region != Region::Unknown)
+			region_entries[static_cast<std::size_t>(region)].push_back(entries.back());
+	}
+
+	std::sort(entries.begin(), entries.end(), RatingEntryOrder());
+	_singles_rates.insertSorted(entries);
+	for (std::size_t region = 0; region < region_count; ++region)
+	{
+		std::sort(region_entries[region].begin(), region_entries[region].end(), RatingEntryOrder());
+		_region_singles_rates[region].insertSorted(region_entries[region]);
+	}
+
+	return entries.size();
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+void BasicManager<RatingIndex, MatchingPolicy, Range>::parseCsv(std::shared_ptr<Player> player, const std::string& line)
+{
+	std::vector<std::string> tokens;
+	manager_detail::splitCsv(line, tokens);
+	if (tokens.empty() || _commands.find(tokens[0]) == _commands.end())
+	{
+		logEvent(LogLevel::Info, "invalid_command", player->sessionId(), tokens.empty() ? nullptr : tokens[0].c_str());
+		std::string msg = "Invalid command.";
+		if (!isOnline(player->name()))
+		{
+			msg += " Please reconnect and first login using: ";
+			msg += manager_detail::login_usage;
+		}
+		player->logout();
+		player->sendMessage(msg);
+		return;
+	}
+	if (tokens[0] != "login" && !isOnline(player->name()))
+	{
+		player->logout();
+		player->sendMessage("You must first log in into the system. Please reconnect again.");
+		return;
+	}
+	logEvent(LogLevel::Debug, "command", player->sessionId(), tokens[0].c_str());
+	player->sendMessage(_commands[tokens[0]](player, ArgList(tokens.begin() + 1, tokens.end())));
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+void BasicManager<RatingIndex, MatchingPolicy, Range>::init()
+{
+	using std::placeholders::_1;
+	using std::placeholders::_2;
+
+	_commands["login"]    = std::bind(&BasicManager::login, this, _1, _2);
+	_commands["list_all"] = std::bind(&BasicManager::listAll, this, _1, _2);
+	_commands["nearby"]   = std::bind(&BasicManager::nearby, this, _1, _2);
+	_commands["match"]    = std::bind(&BasicManager::match, this, _1, _2);
+	_commands["logout"]   = std::bind(&BasicManager::logout, this, _1, _2);
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+MatchOutcome BasicManager<RatingIndex, MatchingPolicy, Range>::loginPlayer(const std::shared_ptr<Player>& player, const std::string& name,
+		const std::string& country, const std::size_t rating)
+{
+	if (name.empty() || name.size() > Player::max_name_size)
+		return MatchOutcome{Status::InvalidName, nullptr};
+
+	CountryCode country_code;
+	if (!parseCountryCode(country, country_code))
+		return MatchOutcome{Status::InvalidCountry, nullptr};
+
+	if (rating > Range::max_rating)
+		return MatchOutcome{Status::InvalidRating, nullptr};
+
+	WriteLock guard(_mutex);
+
+	//To avoid login as foo and bar in one session:
+	const auto existingPlayerSession = [this](const auto& player)
+	{
+		return _online_users.find(player->name()) != _online_users.end();
+	};
+
+	if (existingPlayerSession(player))
+		return MatchOutcome{Status::AlreadyLoggedIn, nullptr};
+	const auto existing = _online_users.find(name);
+	if (existing != _online_users.end())
+	{
+		if (!existing->second->isPlaceholder())
+			return MatchOutcome{Status::AlreadyLoggedIn, nullptr};
+		//A preloaded player gives its name to the player who logs in with it. Its opponent,
+		//if any, is told it logged out.
+		noThreadSafeRemovePlayer(existing);
+	}
+	player->setProfile(name, country_code, rating);
+	_online_users.emplace(player->name(), player);
+	noThreadSafeAddSingle(*player);
+
+	const auto match_res = noThreadSafeFindMatch(player, true);
+	if (!match_res.first)
+		return MatchOutcome{Status::Ok, nullptr};
+
+	noThreadSafeUpdateMatchCaches(player, match_res.second);
+	auto opponent = _online_users[match_res.second];
+	opponent->paired(player);
+	return MatchOutcome{Status::Ok, opponent};
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+Message BasicManager<RatingIndex, MatchingPolicy, Range>::login(std::shared_ptr<Player>& player, const ArgList& args)
+{
+	if (args.size() != 3)
+		return manager_detail::invalidParameters(manager_detail::login_usage);
+
+	std::size_t rate = 0;
+	if (!manager_detail::parseCount(args[2], rate))
+		rate = Range::max_rating + 1;	//Reported as an invalid rating
+
+	const auto outcome = loginPlayer(player, args[0], args[1], rate);
+	switch (outcome.status)
+	{
+		case Status::InvalidName:
+			return manager_detail::text("Invalid name. It should have between 1 and " + std::to_string(Player::max_name_size) + " characters");
+		case Status::InvalidCountry:
+			return manager_detail::text("Invalid country. It should be an ISO 3166 alpha-2 code, e.g. IR");
+		case Status::InvalidRating:
+			return manager_detail::text("Invalid rating. It should be between 0 and " + std::to_string(Range::max_rating));
+		case Status::AlreadyLoggedIn:
+			return Message{manager_detail::already_logged};
+		default:
+			break;
+	}
+	if (outcome.opponent)
+		return Message{manager_detail::logged_in, player->descriptor(), manager_detail::also_paired, outcome.opponent->descriptor()};
+	return Message{manager_detail::logged_in, player->descriptor()};
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+std::vector<RatingEntry> BasicManager<RatingIndex, MatchingPolicy, Range>::noThreadSafeSortedOnline() const
+{
+	std::vector<RatingEntry> res;
+	res.reserve(_online_users.size());
+	for (const auto& user : _online_users)
+		res.emplace_back(user.second->rating(), user.first);
+	std::sort(res.begin(), res.end(), RatingEntryOrder());
+	return res;
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+std::vector<RatedPlayer> BasicManager<RatingIndex, MatchingPolicy, Range>::onlinePlayers()
+{
+	std::vector<RatedPlayer> res;
+
+	ReadLock guard(_mutex);
+
+	const auto entries = noThreadSafeSortedOnline();
+	res.reserve(entries.size());
+	for (const auto& entry : entries)
+		res.push_back(RatedPlayer{entry.second.to_string(), entry.first});
+	return res;
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+Message BasicManager<RatingIndex, MatchingPolicy, Range>::listAll(std::shared_ptr<Player>& /*player*/, const ArgList& args)
+{
+	if (args.size() != 0)
+		return manager_detail::invalidParameters(manager_detail::list_all_usage);
+
+	std::string res;
+	bool first = true;
+
+	ReadLock guard(_mutex);
+
+	for (const auto& entry : noThreadSafeSortedOnline())
+	{
+		if (first)
+			first = false;
+		else
+			res += '\n';
+		res.append(entry.second.data(), entry.second.size());
+		res += ", ";
+		res += std::to_string(entry.first);
+	}
+	return manager_detail::text(std::move(res));
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+std::vector<RatedPlayer> BasicManager<RatingIndex, MatchingPolicy, Range>::nearbyPlayers(const std::shared_ptr<Player>& player,
+		const std::size_t count, const std::size_t range)
+{
+	const auto rating = player->rating();
+	const auto min = rating >= range ? rating - range : 0;
+	const auto max = std::min(rating + range, Range::max_rating);
+
+	//Both walks return their entries closest first, so the first `count` of each are enough
+	const auto collect = [&](const RateList& list)
+	{
+		std::vector<RatingEntry> res;
+		if (count == 0)
+			return res;
+		list.visitOutward(rating, min, max, [&](std::size_t candidate_rating, PlayerName candidate)
+		{
+			if (candidate == player->name())
+				return false;
+			res.emplace_back(candidate_rating, candidate);
+			return res.size() == count;
+		});
+		return res;
+	};
+	const auto closer = [rating](const RatingEntry& lhs, const RatingEntry& rhs)
+	{
+		const auto lhs_distance = lhs.first > rating ? lhs.first - rating : rating - lhs.first;
+		const auto rhs_distance = rhs.first > rating ? rhs.first - rating : rating - rhs.first;
+		return lhs_distance != rhs_distance ? lhs_distance < rhs_distance : lhs.first > rhs.first;
+	};
+
+	std::vector<RatedPlayer> res;
+
+	ReadLock guard(_mutex);
+
+	if (_online_users.find(player->name()) == _online_users.end())
+		return res;
+
+	const auto singles = collect(_singles_rates);
+	const auto waiting = collect(_wait_list_rates);
+	std::vector<RatingEntry> merged;
+	merged.reserve(singles.size() + waiting.size());
+	std::merge(singles.begin(), singles.end(), waiting.begin(), waiting.end(), std::back_inserter(merged), closer);
+	merged.resize(std::min(merged.size(), count));
+
+	res.reserve(merged.size());
+	for (const auto& entry : merged)
+		res.push_back(RatedPlayer{entry.second.to_string(), entry.first});
+	return res;
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+Message BasicManager<RatingIndex, MatchingPolicy, Range>::nearby(std::shared_ptr<Player>& player, const ArgList& args)
+{
+	std::size_t count = 0, range = Range::max_rating;
+	if (args.empty() || args.size() > 2 || !manager_detail::parseCount(args[0], count) || count == 0 || count > max_nearby ||
+			(args.size() == 2 && !manager_detail::parseCount(args[1], range)))
+		return manager_detail::invalidParameters(manager_detail::nearby_usage);
+
+	const auto players = nearbyPlayers(player, count, range);
+	if (players.empty())
+		return manager_detail::text("There is no available player nearby");
+
+	std::string res;
+	for (const auto& nearby_player : players)
+	{
+		if (!res.empty())
+			res += '\n';
+		res += nearby_player.name;
+		res += ", ";
+		res += std::to_string(nearby_player.rating);
+	}
+	return manager_detail::text(std::move(res));
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+std::pair<bool, PlayerName> BasicManager<RatingIndex, MatchingPolicy, Range>::noThreadSafeFindMatch(const std::shared_ptr<Player>& player, bool onlyInWaitList,
+		bool onlyInRegion) const
+{
+	const auto region = regionOf(player->countryCode());
+	const auto region_index = static_cast<std::size_t>(region);
+	const auto& wait_list = onlyInRegion ? _region_wait_list_rates[region_index] : _wait_list_rates;
+	const auto& singles = onlyInRegion ? _region_singles_rates[region_index] : _singles_rates;
+
+	const auto findInList = [&player](const RateList& list)
+	{
+		const auto rating = player->rating();
+		return MatchingPolicy::find(list, player->name(), rating, Range::lower(rating), Range::upper(rating));
+	};
+
+	auto res = std::make_pair(false, PlayerName());
+
+	auto wait_res = findInList(wait_list);
+	//Players waiting for an opponent of their region are only in the regional wait list. A
+	//global search of the same region can pair with them, it's a regional match for them.
+	if (wait_res.empty() && !onlyInRegion && region != Region::Unknown)
+		wait_res = findInList(_region_wait_list_rates[region_index]);
+	if (!wait_res.empty())
+	{
+		res.first = true, res.second = wait_res;
+		const auto iter = _online_users.find(res.second);
+		iter->second->cancelWaiting();
+	}
+
+	if (!res.first && !onlyInWaitList)
+	{
+		const auto singles_res = findInList(singles);
+		if (!singles_res.empty())
+			res.first = true, res.second = singles_res;
+	}
+
+	return res;
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+void BasicManager<RatingIndex, MatchingPolicy, Range>::noThreadSafeUpdateMatchCaches(const std::shared_ptr<Player>& player, const PlayerName opponent)
+{
+	const auto opponent_player = _online_users[opponent];
+
+	noThreadSafeRemoveAvailable(*player);
+	noThreadSafeRemoveAvailable(*opponent_player);
+
+	_match_list[player->name()] = opponent;
+	_match_list[opponent]       = player->name();
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+void BasicManager<RatingIndex, MatchingPolicy, Range>::noThreadSafeAddSingle(const Player& player)
+{
+	_singles_rates.insert(player.rating(), player.name());
+	const auto region = regionOf(player.countryCode());
+	if (region != Region::Unknown)
+		_region_singles_rates[static_cast<std::size_t>(region)].insert(player.rating(), player.name());
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+void BasicManager<RatingIndex, MatchingPolicy, Range>::noThreadSafeAddWaiting(const Player& player, bool onlyInRegion)
+{
+	noThreadSafeRemoveAvailable(player);
+	const auto region = regionOf(player.countryCode());
+	if (!onlyInRegion)
+		_wait_list_rates.insert(player.rating(), player.name());
+	else
+		_regional_waiters.insert(player.name());
+	if (region != Region::Unknown)
+		_region_wait_list_rates[static_cast<std::size_t>(region)].insert(player.rating(), player.name());
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+void BasicManager<RatingIndex, MatchingPolicy, Range>::noThreadSafeRemoveAvailable(const Player& player)
+{
+	_wait_list_rates.erase(player.rating(), player.name());
+	_singles_rates.erase(player.rating(), player.name());
+	const auto region = regionOf(player.countryCode());
+	if (region != Region::Unknown)
+	{
+		_region_wait_list_rates[static_cast<std::size_t>(region)].erase(player.rating(), player.name());
+		_region_singles_rates[static_cast<std::size_t>(region)].erase(player.rating(), player.name());
+	}
+	_regional_waiters.erase(player.name());
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+MatchOutcome BasicManager<RatingIndex, MatchingPolicy, Range>::matchPlayer(const std::shared_ptr<Player>& player, bool regional)
+{
+	WriteLock guard(_mutex);
+
+	if (_online_users.find(player->name()) == _online_users.end())
+		return MatchOutcome{Status::NotLoggedIn, nullptr};
+
+	const auto iter = _match_list.find(player->name());
+	if (iter != _match_list.end())
+		return MatchOutcome{Status::AlreadyPaired, _online_users[iter->second]};
+
+	regional = regional && regionOf(player->countryCode()) != Region::Unknown;
+	auto match_res = noThreadSafeFindMatch(player, false, regional);
+
+	if (!match_res.first && regional)
+	{
+		if (player->waitForARegionalMatch())
+		{
+			noThreadSafeAddWaiting(*player, true);
+			return MatchOutcome{Status::WaitingInRegion, nullptr};
+		}
+		match_res = noThreadSafeFindMatch(player, false);
+	}
+
+	if (!match_res.first)
+	{
+		noThreadSafeAddWaiting(*player, false);
+		player->waitForAMatch();
+		return MatchOutcome{Status::Waiting, nullptr};
+	}
+
+	noThreadSafeUpdateMatchCaches(player, match_res.second);
+	auto opponent = _online_users[match_res.second];
+	opponent->paired(player);
+	return MatchOutcome{Status::Ok, opponent};
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+Message BasicManager<RatingIndex, MatchingPolicy, Range>::match(std::shared_ptr<Player>& player, const ArgList& args)
+{
+	if (args.size() > 1 || (args.size() == 1 && args[0] != "region"))
+		return manager_detail::invalidParameters(manager_detail::match_usage);
+
+	const auto outcome = matchPlayer(player, !args.empty());
+	switch (outcome.status)
+	{
+		case Status::AlreadyPaired:
+			return Message{manager_detail::already_paired, outcome.opponent->descriptor()};
+		case Status::Waiting:
+			return Message{manager_detail::no_match};
+		case Status::WaitingInRegion:
+			return Message{manager_detail::no_region_match};
+		case Status::NotLoggedIn:
+			return manager_detail::text("You must first log in into the system.");
+		default:
+			return Message{manager_detail::paired, outcome.opponent->descriptor()};
+	}
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+void BasicManager<RatingIndex, MatchingPolicy, Range>::widenMatch(const std::shared_ptr<Player>& player)
+{
+	WriteLock guard(_mutex);
+
+	//The fallback may run after the player was paired, logged out or asked for another match
+	const auto iter = _online_users.find(player->name());
+	if (iter == _online_users.end() || iter->second != player || _regional_waiters.find(player->name()) == _regional_waiters.end())
+		return;
+
+	const auto match_res = noThreadSafeFindMatch(player, false);
+	if (!match_res.first)
+	{
+		logEvent(LogLevel::Debug, "regional_fallback", player->sessionId(), nullptr, regionName(regionOf(player->countryCode())));
+		noThreadSafeAddWaiting(*player, false);
+		player->waitForAMatch();
+		return;
+	}
+
+	noThreadSafeUpdateMatchCaches(player, match_res.second);
+	auto opponent = _online_users[match_res.second];
+	opponent->paired(player);
+	player->paired(opponent);
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+Status BasicManager<RatingIndex, MatchingPolicy, Range>::logoutPlayer(const std::shared_ptr<Player>& player)
+{
+	WriteLock guard(_mutex);
+
+	auto iter = _online_users.find(player->name());
+	if (iter == _online_users.end())
+		return Status::NotLoggedIn;
+
+	noThreadSafeRemovePlayer(iter);
+	return Status::Ok;
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+void BasicManager<RatingIndex, MatchingPolicy, Range>::noThreadSafeRemovePlayer(const typename OnlineList::iterator iter)
+{
+	const auto player = iter->second;
+
+	auto match_iter = _match_list.find(player->name());
+	if (match_iter != _match_list.end())
+	{
+		auto opponent_player = _online_users[match_iter->second];
+		opponent_player->opponentLoggedOut(player);
+
+		_match_list.erase(match_iter);
+		_match_list.erase(opponent_player->name());
+		noThreadSafeAddSingle(*opponent_player);
+	}
+
+	//Otherwise a later match could pick a player who isn't online anymore:
+	noThreadSafeRemoveAvailable(*player);
+	player->cancelWaiting();
+	player->logout();
+	//Note that PlayerSession::read's handler keep a shared ptr. So it's safe to remove it:
+	_online_users.erase(iter);
+}
+
+template <class RatingIndex, class MatchingPolicy, class Range>
+Message BasicManager<RatingIndex, MatchingPolicy, Range>::logout(std::shared_ptr<Player>& player, const ArgList& args)
+{
+	if (args.size() != 0)
+		return manager_detail::invalidParameters(manager_detail::logout_usage);
+
+	logoutPlayer(player);
+	return Message{manager_detail::logged_out, player->descriptor()};
+}
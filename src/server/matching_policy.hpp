@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "player.hpp"
+
+//The ratings a player can be matched with: [rating - Offset, rating + Offset], clamped to
+//[MinRating, MaxRating]. Players can't log in with a rating above MaxRating.
+template <std::size_t MinRating, std::size_t MaxRating, std::size_t Offset>
+struct RatingRange
+{
+	static_assert(MinRating <= MaxRating, "Invalid rating range");
+
+	static constexpr std::size_t min_rating = MinRating;
+	static constexpr std::size_t max_rating = MaxRating;
+	static constexpr std::size_t offset     = Offset;
+
+	static constexpr std::size_t lower(std::size_t rating)
+	{
+		return rating >= MinRating + Offset ? rating - Offset : MinRating;
+	}
+
+	static constexpr std::size_t upper(std::size_t rating)
+	{
+		return rating + Offset <= MaxRating ? rating + Offset : MaxRating;
+	}
+};
+
+template <std::size_t MinRating, std::size_t MaxRating, std::size_t Offset>
+constexpr std::size_t RatingRange<MinRating, MaxRating, Offset>::min_rating;
+template <std::size_t MinRating, std::size_t MaxRating, std::size_t Offset>
+constexpr std::size_t RatingRange<MinRating, MaxRating, Offset>::max_rating;
+template <std::size_t MinRating, std::size_t MaxRating, std::size_t Offset>
+constexpr std::size_t RatingRange<MinRating, MaxRating, Offset>::offset;
+
+//Matching policies for BasicManager. A policy picks an opponent for `name` among the
+//entries of a rating index whose rating is in [min, max]. It returns an empty name if
+//there is none.
+
+//Picks the highest rated candidate. It's the original behaviour of the manager.
+struct HighestRatingFirst
+{
+	template <class RatingIndex>
+	static PlayerName find(const RatingIndex& index, PlayerName name, std::size_t /*rating*/,
+			std::size_t min, std::size_t max)
+	{
+		PlayerName res;
+		index.visitDescending(max, min, [&](std::size_t, PlayerName candidate)
+		{
+			if (candidate == name)
+				return false;
+			res = candidate;
+			return true;
+		});
+		return res;
+	}
+};
+
+//Picks the candidate with the closest rating, checking higher ratings first on ties
+struct ClosestRatingFirst
+{
+	template <class RatingIndex>
+	static PlayerName find(const RatingIndex& index, PlayerName name, std::size_t rating,
+			std::size_t min, std::size_t max)
+	{
+		PlayerName res;
+		index.visitOutward(rating, min, max, [&](std::size_t, PlayerName candidate)
+		{
+			if (candidate == name)
+				return false;
+			res = candidate;
+			return true;
+		});
+		return res;
+	}
+};
@@ -0,0 +1,142 @@
+#include "matchmaking_api.hpp"
+#include "server.hpp"
+
+#include <boost/asio/post.hpp>
+
+LocalPlayer::LocalPlayer(boost::asio::io_context& io, Manager& manager, Handlers handlers) :
+	_io(io),
+	_manager(manager),
+	_timer(io),
+	_handlers(std::move(handlers))
+{
+}
+
+void LocalPlayer::waitForAMatch()
+{
+	_timer.expires_from_now(boost::posix_time::seconds(wait_timeout));
+
+	std::weak_ptr<LocalPlayer> weak_self = shared_from_this();
+	_timer.async_wait([weak_self](const boost::system::error_code& errorCode)
+	{
+		const auto self = weak_self.lock();
+		if (errorCode || !self)
+			return;
+		auto& manager = self->_manager;
+		if (manager.isOnline(self->name()) && !manager.hasMatch(self->name()) && self->_handlers.matchTimeout)
+			self->_handlers.matchTimeout();
+	});
+}
+
+bool LocalPlayer::waitForARegionalMatch()
+{
+	_timer.expires_from_now(boost::posix_time::seconds(region_timeout));
+
+	std::weak_ptr<LocalPlayer> weak_self = shared_from_this();
+	_timer.async_wait([weak_self](const boost::system::error_code& errorCode)
+	{
+		const auto self = weak_self.lock();
+		if (!errorCode && self)
+			self->_manager.widenMatch(self);
+	});
+	return true;
+}
+
+void LocalPlayer::cancelWaiting()
+{
+	_timer.cancel();
+}
+
+boost::asio::deadline_timer::duration_type LocalPlayer::deadline() const
+{
+	return _timer.expires_from_now();
+}
+
+//Called with the manager's lock held: the handler runs later, so it can call the API again
+void LocalPlayer::paired(const std::shared_ptr<Player>& opponent)
+{
+	if (!_handlers.paired)
+		return;
+	auto self = shared_from_this();
+	boost::asio::post(_io, [self, info = PlayerInfo::of(*opponent)]()
+	{
+		self->_handlers.paired(info);
+	});
+}
+
+void LocalPlayer::opponentLoggedOut(const std::shared_ptr<Player>& opponent)
+{
+	if (!_handlers.opponentLoggedOut)
+		return;
+	auto self = shared_from_this();
+	boost::asio::post(_io, [self, info = PlayerInfo::of(*opponent)]()
+	{
+		self->_handlers.opponentLoggedOut(info);
+	});
+}
+
+MatchmakingApi::MatchmakingApi(boost::asio::io_context& io, Manager& manager) :
+	_io(io),
+	_manager(manager)
+{
+}
+
+std::shared_ptr<LocalPlayer> MatchmakingApi::createPlayer(LocalPlayer::Handlers handlers)
+{
+	return std::make_shared<LocalPlayer>(_io, _manager, std::move(handlers));
+}
+
+MatchmakingApi::MatchResult MatchmakingApi::toResult(const MatchOutcome& outcome)
+{
+	MatchResult res{outcome.status, boost::none};
+	if (outcome.opponent)
+		res.opponent = PlayerInfo::of(*outcome.opponent);
+	return res;
+}
+
+void MatchmakingApi::login(std::shared_ptr<LocalPlayer> player, std::string name, std::string country, const std::size_t rating, MatchCallback callback)
+{
+	boost::asio::post(_io, [&manager = _manager, player, name = std::move(name), country = std::move(country), rating, callback = std::move(callback)]()
+	{
+		callback(toResult(manager.loginPlayer(player, name, country, rating)));
+	});
+}
+
+void MatchmakingApi::listAll(ListCallback callback)
+{
+	boost::asio::post(_io, [&manager = _manager, callback = std::move(callback)]()
+	{
+		callback(manager.onlinePlayers());
+	});
+}
+
+void MatchmakingApi::nearby(std::shared_ptr<LocalPlayer> player, std::size_t count, std::size_t range, ListCallback callback)
+{
+	boost::asio::post(_io, [&manager = _manager, player, count, range, callback = std::move(callback)]()
+	{
+		callback(manager.nearbyPlayers(player, count, range));
+	});
+}
+
+void MatchmakingApi::match(std::shared_ptr<LocalPlayer> player, MatchCallback callback)
+{
+	boost::asio::post(_io, [&manager = _manager, player, callback = std::move(callback)]()
+	{
+		callback(toResult(manager.matchPlayer(player)));
+	});
+}
+
+void MatchmakingApi::matchInRegion(std::shared_ptr<LocalPlayer> player, MatchCallback callback)
+{
+	boost::asio::post(_io, [&manager = _manager, player, callback = std::move(callback)]()
+	{
+		callback(toResult(manager.matchPlayer(player, true)));
+	});
+}
+
+void MatchmakingApi::logout(std::shared_ptr<LocalPlayer> player, StatusCallback callback)
+{
+	boost::asio::post(_io, [&manager = _manager, player, callback = std::move(callback)]()
+	{
+		callback(manager.logoutPlayer(player));
+	});
+}
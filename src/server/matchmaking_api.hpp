@@ -0,0 +1,87 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/optional.hpp>
+
+#include "manager.hpp"
+
+//In-process access to the matchmaking core for co-located game servers: no socket and no CSV.
+//Requests run on the io_context, serialized with the network sessions if it's the server's,
+//and results are passed to callbacks as values. Queued requests and players' timers only
+//refer to the manager, not to the MatchmakingApi: the API object may be destroyed while
+//work is queued, but the manager and the io_context must outlive it.
+
+struct PlayerInfo
+{
+	std::string name;
+	std::string country;
+	std::size_t rating;
+
+	static PlayerInfo of(const Player& player)
+	{
+		return PlayerInfo{player.name().to_string(), player.country(), player.rating()};
+	}
+};
+
+//A player who isn't connected through a socket. Its notifications are posted to the io_context.
+class LocalPlayer : public Player, public std::enable_shared_from_this<LocalPlayer>
+{
+public:
+	struct Handlers
+	{
+		std::function<void (const PlayerInfo& opponent)> paired;
+		std::function<void (const PlayerInfo& opponent)> opponentLoggedOut;
+		std::function<void ()> matchTimeout;	//Nobody was found within the waiting time
+	};
+
+	LocalPlayer(boost::asio::io_context& io, Manager& manager, Handlers handlers);
+
+	virtual void waitForAMatch() override;
+	virtual bool waitForARegionalMatch() override;
+	virtual void cancelWaiting() override;
+	virtual boost::asio::deadline_timer::duration_type deadline() const override;
+	virtual void paired(const std::shared_ptr<Player>& opponent) override;
+	virtual void opponentLoggedOut(const std::shared_ptr<Player>& opponent) override;
+private:
+	boost::asio::io_context& _io;
+	Manager& _manager;
+	boost::asio::deadline_timer _timer;
+	Handlers _handlers;
+};
+
+class MatchmakingApi
+{
+public:
+	struct MatchResult
+	{
+		Status status;
+		boost::optional<PlayerInfo> opponent;	//Set if the player is paired
+	};
+
+	using MatchCallback  = std::function<void (const MatchResult&)>;
+	using StatusCallback = std::function<void (Status)>;
+	using ListCallback   = std::function<void (const std::vector<RatedPlayer>&)>;
+
+	explicit MatchmakingApi(boost::asio::io_context& io, Manager& manager = Manager::instance());
+
+	std::shared_ptr<LocalPlayer> createPlayer(LocalPlayer::Handlers handlers);
+
+	void login(std::shared_ptr<LocalPlayer> player, std::string name, std::string country, std::size_t rating, MatchCallback callback);
+	void listAll(ListCallback callback);
+	void nearby(std::shared_ptr<LocalPlayer> player, std::size_t count, std::size_t range, ListCallback callback);
+	void match(std::shared_ptr<LocalPlayer> player, MatchCallback callback);
+	//Looks for an opponent of the player's region first, see Manager::matchPlayer
+	void matchInRegion(std::shared_ptr<LocalPlayer> player, MatchCallback callback);
+	void logout(std::shared_ptr<LocalPlayer> player, StatusCallback callback);
+private:
+	static MatchResult toResult(const MatchOutcome& outcome);
+
+	boost::asio::io_context& _io;
+	Manager& _manager;
+};
@@ -1,22 +1,77 @@
 #include "player.hpp"
 
-#include <sstream>
+#include <cassert>
 
-void Player::setProfile(const std::string& name, const std::string& country, const std::size_t rating)
+SharedBuffer makeBuffer(std::string text)
 {
-	_name = name;
-	_country = country;
-	_rating = rating;
+	return std::make_shared<const std::string>(std::move(text));
 }
 
-boost::asio::deadline_timer::duration_type Player::deadline() const
+bool parseCountryCode(const std::string& text, CountryCode& code)
 {
-	return boost::asio::deadline_timer::duration_type();
+	if (text.size() != code.size())
+		return false;
+	for (std::size_t i = 0; i < code.size(); ++i)
+	{
+		auto c = text[i];
+		if (c >= 'a' && c <= 'z')
+			c = static_cast<char>(c - 'a' + 'A');
+		if (c < 'A' || c > 'Z')
+			return false;
+		code[i] = c;
+	}
+	return true;
+}
+
+namespace
+{
+	const SharedBuffer empty_descriptor = makeBuffer(std::string());
+	const SharedBuffer paired_with      = makeBuffer("You've paired with ");
+	const SharedBuffer opponent_left    = makeBuffer("Your opponent logged out from the system: ");
+}
+
+constexpr std::size_t Player::max_name_size;
+constexpr std::size_t Player::name_offset;
+
+Player::Player() :
+	_descriptor(empty_descriptor),
+	_name_size(0),
+	_rating(0),
+	_country{{' ', ' '}}
+{
+}
+
+void Player::setProfile(const PlayerName name, const CountryCode& country, const std::size_t rating)
+{
+	assert(name.size() <= max_name_size && rating <= UINT16_MAX);
+
+	_name_size = static_cast<std::uint16_t>(name.size());
+	_rating    = static_cast<std::uint16_t>(rating);
+	_country   = country;
+
+	const auto rating_str = std::to_string(_rating);
+	std::string descriptor;
+	descriptor.reserve(name_offset + name.size() + 11 + _country.size() + 10 + rating_str.size());
+	descriptor += "name: ";
+	descriptor.append(name.data(), name.size());
+	descriptor += ", country: ";
+	descriptor.append(_country.data(), _country.size());
+	descriptor += ", rating: ";
+	descriptor += rating_str;
+	_descriptor = makeBuffer(std::move(descriptor));
+}
+
+void Player::paired(const std::shared_ptr<Player>& opponent)
+{
+	sendMessage(Message{paired_with, opponent->descriptor()});
 }
 
-std::string Player::toString() const
+void Player::opponentLoggedOut(const std::shared_ptr<Player>& opponent)
 {
-	std::ostringstream oss;
-	oss << "name: " << _name << ", country: " << _country << ", rating: " << _rating;
-	return oss.str();
+	sendMessage(Message{opponent_left, opponent->descriptor()});
+}
+
+boost::asio::deadline_timer::duration_type Player::deadline() const
+{
+	return boost::asio::deadline_timer::duration_type();
 }
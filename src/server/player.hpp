@@ -1,25 +1,79 @@
 #pragma once
 
 #include <boost/asio/deadline_timer.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/utility/string_view.hpp>
+#include <array>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
+
+//Replies are gather lists of immutable, reference counted buffers. The same buffer (e.g. a
+//player's descriptor) can be part of many messages without being copied.
+using SharedBuffer = std::shared_ptr<const std::string>;
+using Message = std::vector<SharedBuffer>;
+
+SharedBuffer makeBuffer(std::string text);
+
+//A player's name is stored once, in its descriptor. Everything else refers to it with a view,
+//which stays valid as long as the player is alive and its profile isn't changed.
+using PlayerName = boost::string_view;
+
+struct PlayerNameHash
+{
+	std::size_t operator()(PlayerName name) const
+	{
+		return boost::hash_range(name.begin(), name.end());
+	}
+};
+
+//ISO 3166-1 alpha-2 country code, in upper case
+using CountryCode = std::array<char, 2>;
+
+//Accepts two ASCII letters in any case
+bool parseCountryCode(const std::string& text, CountryCode& code);
 
 class Player
 {
 public:
-	Player() = default;
-	void setProfile(const std::string& name, const std::string& country, std::size_t rating);
+	static constexpr std::size_t max_name_size = 64;
+
+	Player();
+	//The name must have at most max_name_size characters and the rating must fit in 16 bits
+	void setProfile(PlayerName name, const CountryCode& country, std::size_t rating);
 	virtual void waitForAMatch() {};
+	//Waits for an opponent of the player's region. After a short delay the implementation calls
+	//the manager's widenMatch to look in every region. Players who can't schedule it return
+	//false and are matched globally right away.
+	virtual bool waitForARegionalMatch() {return false;}
 	virtual void cancelWaiting() {};
-	virtual void sendMessage(const std::string& message) {}
+	//A message is one line. Implementations add the line break.
+	virtual void sendMessage(Message /*message*/) {}
+	void sendMessage(const std::string& message) {sendMessage(Message{makeBuffer(message)});}
+	//Notifications from the manager, called while it holds its lock. They're sent as messages
+	//unless overridden.
+	virtual void paired(const std::shared_ptr<Player>& opponent);
+	virtual void opponentLoggedOut(const std::shared_ptr<Player>& opponent);
 	virtual boost::asio::deadline_timer::duration_type deadline() const;
 	virtual void logout() {};
+	virtual std::uint64_t sessionId() const {return 0;}
+	//A player without a session (e.g. preloaded) that only holds its name until its owner logs in
+	virtual bool isPlaceholder() const {return false;}
 	virtual ~Player() = default;
 
-	std::string toString() const;
-	const std::string& name() const {return _name;}
+	const std::string& toString() const {return *_descriptor;}
+	//Serialized once by setProfile
+	const SharedBuffer& descriptor() const {return _descriptor;}
+	PlayerName name() const {return _name_size == 0 ? PlayerName() : PlayerName(_descriptor->data() + name_offset, _name_size);}
+	std::string country() const {return std::string(_country.data(), _country.size());}
+	const CountryCode& countryCode() const {return _country;}
 	std::size_t rating() const {return _rating;}
 private:
-	std::string _name;
-	std::string _country;
-	std::size_t _rating; //Assume it's an integer between 50 and 3000
+	static constexpr std::size_t name_offset = 6;	//"name: "
+
+	SharedBuffer _descriptor;	//"name: <name>, country: <country>, rating: <rating>"
+	std::uint16_t _name_size;
+	std::uint16_t _rating;
+	CountryCode _country;
 };
@@ -0,0 +1,331 @@
+#include "preload.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace
+{
+	const char snapshot_magic[8]    = {'M', 'M', 'S', 'N', 'A', 'P', '0', '2'};
+	const char snapshot_magic_v1[8] = {'M', 'M', 'S', 'N', 'A', 'P', '0', '1'};	//Without the chunk index, still read
+
+	const std::uint64_t records_per_chunk = 65536;
+	const std::size_t min_record_size = sizeof(std::uint32_t) + 2 * sizeof(std::uint16_t);
+
+	//Stands for a player until they log in again, see BasicManager::loginPlayer
+	class PreloadedPlayer : public Player
+	{
+	public:
+		virtual bool isPlaceholder() const override {return true;}
+	};
+
+	//Returns null if the profile isn't valid
+	std::shared_ptr<Player> makePlayer(const std::string& name, const std::string& country, std::size_t rating)
+	{
+		CountryCode code;
+		if (name.empty() || name.size() > Player::max_name_size || !parseCountryCode(country, code) || rating > UINT16_MAX)
+			return nullptr;
+		auto player = std::make_shared<PreloadedPlayer>();
+		player->setProfile(name, code, rating);
+		return player;
+	}
+
+	template <class T>
+	T readScalar(const char*& pos, const char* end)
+	{
+		if (static_cast<std::size_t>(end - pos) < sizeof(T))
+			throw std::runtime_error("Truncated snapshot");
+		T value;
+		std::memcpy(&value, pos, sizeof(T));
+		pos += sizeof(T);
+		return value;
+	}
+
+	std::string readString(const char*& pos, const char* end, std::size_t size)
+	{
+		if (static_cast<std::size_t>(end - pos) < size)
+			throw std::runtime_error("Truncated snapshot");
+		std::string res(pos, size);
+		pos += size;
+		return res;
+	}
+
+	PlayerList concatenate(std::vector<PlayerList>& parts)
+	{
+		std::size_t total = 0;
+		for (const auto& part : parts)
+			total += part.size();
+
+		auto& players = parts[0];
+		players.reserve(total);
+		for (std::size_t i = 1; i < parts.size(); ++i)
+			players.insert(players.end(), std::make_move_iterator(parts[i].begin()), std::make_move_iterator(parts[i].end()));
+		return std::move(players);
+	}
+
+	//Parses exactly `count` records, which must fill [pos, end)
+	void parseRecords(const char* pos, const char* end, std::uint64_t count, PlayerList& players)
+	{
+		//Checked before reserving, so a corrupt count can't ask for a huge allocation
+		if (count > static_cast<std::size_t>(end - pos) / min_record_size)
+			throw std::runtime_error("Truncated snapshot");
+
+		players.reserve(players.size() + count);
+		for (std::uint64_t i = 0; i < count; ++i)
+		{
+			const auto rating       = readScalar<std::uint32_t>(pos, end);
+			const auto name_size    = readScalar<std::uint16_t>(pos, end);
+			const auto country_size = readScalar<std::uint16_t>(pos, end);
+			const auto name         = readString(pos, end, name_size);
+			const auto country      = readString(pos, end, country_size);
+
+			auto player = makePlayer(name, country, rating);
+			if (!player)
+				throw std::runtime_error("Invalid player in snapshot: " + name.substr(0, Player::max_name_size));
+			players.push_back(std::move(player));
+		}
+		if (pos != end)
+			throw std::runtime_error("Corrupt snapshot");
+	}
+
+	PlayerList parseSnapshot(const char* begin, const char* end, unsigned threads)
+	{
+		const char* pos = begin + sizeof(snapshot_magic);
+		const auto count = readScalar<std::uint64_t>(pos, end);
+		PlayerList players;
+		if (std::memcmp(begin, snapshot_magic_v1, sizeof(snapshot_magic_v1)) == 0)
+		{
+			parseRecords(pos, end, count, players);
+			return players;
+		}
+
+		//The chunk index: chunks of records_per_chunk records, the last one may be shorter
+		const auto per_chunk = readScalar<std::uint64_t>(pos, end);
+		const auto chunk_count = readScalar<std::uint64_t>(pos, end);
+		if (per_chunk == 0 || chunk_count != count / per_chunk + (count % per_chunk != 0) ||
+				chunk_count > static_cast<std::size_t>(end - pos) / sizeof(std::uint64_t))
+			throw std::runtime_error("Corrupt snapshot");
+		std::vector<const char*> bounds;
+		bounds.reserve(chunk_count + 1);
+		const auto records = pos + chunk_count * sizeof(std::uint64_t);
+		if (count > static_cast<std::size_t>(end - records) / min_record_size)
+			throw std::runtime_error("Truncated snapshot");
+		for (std::uint64_t i = 0; i < chunk_count; ++i)
+		{
+			const auto offset = readScalar<std::uint64_t>(pos, end);
+			if (offset < static_cast<std::size_t>(records - begin) || offset > static_cast<std::size_t>(end - begin) ||
+					(!bounds.empty() && begin + offset < bounds.back()))
+				throw std::runtime_error("Corrupt snapshot");
+			bounds.push_back(begin + offset);
+		}
+		bounds.push_back(end);
+
+		//Every thread takes a run of consecutive chunks
+		threads = static_cast<unsigned>(std::max<std::uint64_t>(1, std::min<std::uint64_t>(threads, chunk_count)));
+		std::vector<PlayerList> parts(threads);
+		std::vector<std::exception_ptr> errors(threads);
+		const auto parsePart = [&](unsigned part)
+		{
+			const auto first = chunk_count * part / threads;
+			const auto last  = chunk_count * (part + 1) / threads;
+			try
+			{
+				//Chunk by chunk, so every offset of the index is checked
+				parts[part].reserve(std::min(count, last * per_chunk) - first * per_chunk);
+				for (auto chunk = first; chunk < last; ++chunk)
+					parseRecords(bounds[chunk], bounds[chunk + 1], std::min(count - chunk * per_chunk, per_chunk), parts[part]);
+			}
+			catch (...)
+			{
+				errors[part] = std::current_exception();
+			}
+		};
+		std::vector<std::thread> workers;
+		for (unsigned i = 1; i < threads; ++i)
+			workers.emplace_back(parsePart, i);
+		parsePart(0);
+		for (auto& worker : workers)
+			worker.join();
+		for (const auto& error : errors)
+		{
+			if (error)
+				std::rethrow_exception(error);
+		}
+		return concatenate(parts);
+	}
+
+	bool parseRating(const char* begin, const char* end, std::size_t& rating)
+	{
+		if (begin == end)
+			return false;
+		rating = 0;
+		for (; begin != end; ++begin)
+		{
+			if (*begin < '0' || *begin > '9' || rating > std::numeric_limits<std::uint32_t>::max())
+				return false;
+			rating = rating * 10 + static_cast<std::size_t>(*begin - '0');
+		}
+		return true;
+	}
+
+	//Parses "[login,]name,country,rate". Returns false if the line doesn't have that layout.
+	bool parseCsvLine(const char* begin, const char* end, PlayerList& players)
+	{
+		if (end != begin && end[-1] == '\r')
+			--end;
+
+		const char* fields[5];
+		std::size_t count = 0;
+		fields[count++] = begin;
+		for (auto pos = begin; pos != end; ++pos)
+		{
+			if (*pos != ',')
+				continue;
+			if (count == 4)
+				return false;
+			fields[count++] = pos + 1;
+		}
+		fields[count] = end + 1;
+
+		std::size_t first = 0;
+		if (count == 4)
+		{
+			if (std::string(fields[0], fields[1] - 1) != "login")
+				return false;
+			first = 1;
+		}
+		else if (count != 3)
+			return false;
+
+		const auto field = [&fields](std::size_t i) {return std::string(fields[i], fields[i + 1] - 1);};
+
+		std::size_t rating;
+		if (fields[first + 1] - 1 == fields[first] || !parseRating(fields[first + 2], end, rating))
+			return false;
+
+		auto player = makePlayer(field(first), field(first + 1), rating);
+		if (!player)
+			return false;
+		players.push_back(std::move(player));
+		return true;
+	}
+
+	void parseCsvChunk(const char* begin, const char* end, PlayerList& players)
+	{
+		while (begin != end)
+		{
+			auto line_end = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+			if (line_end == nullptr)
+				line_end = end;
+			if (line_end != begin)
+				parseCsvLine(begin, line_end, players);
+			begin = line_end == end ? end : line_end + 1;
+		}
+	}
+
+	PlayerList parseCsv(const char* begin, const char* end, unsigned threads)
+	{
+		threads = std::max(1u, threads);
+
+		//Chunk boundaries are moved forward to the start of the next line
+		std::vector<const char*> bounds{begin};
+		const auto chunk_size = static_cast<std::size_t>(end - begin) / threads + 1;
+		for (unsigned i = 1; i < threads; ++i)
+		{
+			const char* pos = std::max(bounds.back(), std::min(end, begin + i * chunk_size));
+			const auto line_end = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+			bounds.push_back(line_end == nullptr ? end : line_end + 1);
+		}
+		bounds.push_back(end);
+
+		std::vector<PlayerList> chunks(threads);
+		std::vector<std::thread> workers;
+		for (unsigned i = 1; i < threads; ++i)
+			workers.emplace_back([&, i](){parseCsvChunk(bounds[i], bounds[i + 1], chunks[i]);});
+		parseCsvChunk(bounds[0], bounds[1], chunks[0]);
+		for (auto& worker : workers)
+			worker.join();
+
+		return concatenate(chunks);
+	}
+}
+
+PlayerList loadPlayerFile(const std::string& path, unsigned threads)
+{
+	namespace bip = boost::interprocess;
+
+	std::ifstream probe(path);
+	if (!probe)
+		throw std::runtime_error("Cannot open " + path);
+	probe.seekg(0, std::ios::end);
+	if (probe.tellg() == 0)
+		return PlayerList();
+
+	try
+	{
+		bip::file_mapping file(path.c_str(), bip::read_only);
+		bip::mapped_region region(file, bip::read_only);
+		region.advise(bip::mapped_region::advice_sequential);
+
+		const auto begin = static_cast<const char*>(region.get_address());
+		const auto end   = begin + region.get_size();
+
+		if (region.get_size() >= sizeof(snapshot_magic) && (std::memcmp(begin, snapshot_magic, sizeof(snapshot_magic)) == 0 ||
+				std::memcmp(begin, snapshot_magic_v1, sizeof(snapshot_magic_v1)) == 0))
+			return parseSnapshot(begin, end, threads);
+		return parseCsv(begin, end, threads);
+	}
+	catch (const bip::interprocess_exception& e)
+	{
+		throw std::runtime_error("Cannot map " + path + ": " + e.what());
+	}
+}
+
+void writeSnapshot(const std::string& path, const PlayerList& players)
+{
+	std::ofstream os(path, std::ios::binary | std::ios::trunc);
+	if (!os)
+		throw std::runtime_error("Cannot open " + path);
+
+	const auto writeScalar = [&os](auto value)
+	{
+		os.write(reinterpret_cast<const char*>(&value), sizeof(value));
+	};
+
+	const auto recordSize = [](const Player& player)
+	{
+		return sizeof(std::uint32_t) + 2 * sizeof(std::uint16_t) + player.name().size() + player.country().size();
+	};
+
+	const std::uint64_t count = players.size();
+	const auto chunk_count = (count + records_per_chunk - 1) / records_per_chunk;
+	std::uint64_t offset = sizeof(snapshot_magic) + (3 + chunk_count) * sizeof(std::uint64_t);
+
+	os.write(snapshot_magic, sizeof(snapshot_magic));
+	writeScalar(count);
+	writeScalar(records_per_chunk);
+	writeScalar(chunk_count);
+	for (std::uint64_t i = 0; i < count; ++i)
+	{
+		if (i % records_per_chunk == 0)
+			writeScalar(offset);
+		offset += recordSize(*players[i]);
+	}
+	for (const auto& player : players)
+	{
+		writeScalar(static_cast<std::uint32_t>(player->rating()));
+		writeScalar(static_cast<std::uint16_t>(player->name().size()));
+		writeScalar(static_cast<std::uint16_t>(player->country().size()));
+		os << player->name() << player->country();
+	}
+	if (!os.flush())
+		throw std::runtime_error("Cannot write " + path);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "player.hpp"
+
+using PlayerList = std::vector<std::shared_ptr<Player>>;
+
+//Bulk loading of players, e.g. to warm-start the server or to populate it for tests.
+//A player file is either:
+// - CSV in the login layout, one player per line: "login,name,country,rate" (the leading
+//   "login," is optional). Lines that can't be parsed are skipped.
+// - A binary snapshot written by writeSnapshot.
+//The file is memory mapped and parsed by `threads` threads: each one takes a chunk of lines
+//of a CSV file or a run of chunks of a snapshot. Throws std::runtime_error if the file can't
+//be read or a snapshot is corrupt.
+PlayerList loadPlayerFile(const std::string& path, unsigned threads);
+
+//Snapshot layout, in host byte order: the 8 byte magic "MMSNAP02", a uint64 player count,
+//the chunk index, then for every player a uint32 rating, a uint16 name length, a uint16
+//country length, the name and the country. Players are grouped in chunks of a fixed number of
+//players (the last one may be shorter), so loaders can split them between threads. The
+//index is a uint64 number of players per chunk, a uint64 chunk count and the uint64 file
+//offset of the first player of every chunk. "MMSNAP01" snapshots have no index and are still
+//loaded, by a single thread.
+void writeSnapshot(const std::string& path, const PlayerList& players);
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "player.hpp"
+
+//Rating index policies for BasicManager. Every index keeps (rating, name) pairs and offers:
+//
+//  void insert(std::size_t rating, PlayerName name);
+//  void erase(std::size_t rating, PlayerName name);
+//  bool visitDescending(std::size_t max, std::size_t min, Visitor visitor) const;
+//  bool visitRating(std::size_t rating, Visitor visitor) const;
+//  bool visitOutward(std::size_t center, std::size_t min, std::size_t max, Visitor visitor) const;
+//  void insertSorted(const std::vector<std::pair<std::size_t, PlayerName>>& entries);
+//
+//insertSorted adds many entries at once. They must be sorted by descending rating, then by
+//name, as RatingEntryOrder does. Names are views (see PlayerName): an index doesn't own them.
+//
+//Visitors are called as visitor(rating, name) and return true to stop the walk. The visit
+//functions return true if a visitor stopped the walk. visitDescending and visitRating go in
+//descending rating order. visitOutward goes by increasing distance from center, the higher
+//rating first on ties, so stopping after K entries costs O(K + buckets touched).
+
+using RatingEntry = std::pair<std::size_t, PlayerName>;
+
+struct RatingEntryOrder
+{
+	bool operator()(const RatingEntry& lhs, const RatingEntry& rhs) const
+	{
+		return lhs.first != rhs.first ? lhs.first > rhs.first : lhs.second < rhs.second;
+	}
+};
+
+//Red-black tree of (rating, name) entries, in the order of RatingEntryOrder. Unlike the
+//original layout of the manager, a tree of rating buckets each holding a tree of names, it
+//costs one node per entry and nothing per distinct rating.
+class TreeRatingIndex
+{
+public:
+	void insert(std::size_t rating, PlayerName name)
+	{
+		_entries.emplace(rating, name);
+	}
+
+	void erase(std::size_t rating, PlayerName name)
+	{
+		_entries.erase(RatingEntry(rating, name));
+	}
+
+	void insertSorted(const std::vector<RatingEntry>& entries)
+	{
+		//Sorted input lets every insertion use the end of the tree as its hint
+		for (const auto& entry : entries)
+			_entries.emplace_hint(_entries.end(), entry);
+	}
+
+	template <class Visitor>
+	bool visitDescending(std::size_t max, std::size_t min, Visitor visitor) const
+	{
+		for (auto iter = firstAtMost(max); iter != _entries.end() && iter->first >= min; ++iter)
+		{
+			if (visitor(iter->first, iter->second))
+				return true;
+		}
+		return false;
+	}
+
+	template <class Visitor>
+	bool visitRating(std::size_t rating, Visitor visitor) const
+	{
+		return visitDescending(rating, rating, visitor);
+	}
+
+	template <class Visitor>
+	bool visitOutward(std::size_t center, std::size_t min, std::size_t max, Visitor visitor) const
+	{
+		if (min > max)
+			return false;
+		center = std::min(std::max(center, min), max);
+
+		//[begin, up) are above center and [down, end) aren't
+		auto down = firstAtMost(center);
+		auto up = down;
+		for (;;)
+		{
+			const bool has_up = up != _entries.begin() && std::prev(up)->first <= max;
+			const bool has_down = down != _entries.end() && down->first >= min;
+			if (!has_up && !has_down)
+				return false;
+			if (has_up && (!has_down || std::prev(up)->first - center <= center - down->first))
+			{
+				//Visit the whole rating in name order, like the other walks do
+				const auto first = firstAtMost(std::prev(up)->first);
+				for (auto iter = first; iter != up; ++iter)
+				{
+					if (visitor(iter->first, iter->second))
+						return true;
+				}
+				up = first;
+			}
+			else
+			{
+				if (visitor(down->first, down->second))
+					return true;
+				++down;
+			}
+		}
+	}
+private:
+	using Entries = std::set<RatingEntry, RatingEntryOrder>;
+
+	//The first entry whose rating isn't above `rating`: the empty name comes first
+	Entries::const_iterator firstAtMost(std::size_t rating) const
+	{
+		return _entries.lower_bound(RatingEntry(rating, PlayerName()));
+	}
+
+	Entries _entries;
+};
+
+//One bucket per possible rating. Lookups are a direct index, at the cost of a bucket for
+//every rating in [0, MaxRating] even if nobody has it.
+template <std::size_t MaxRating>
+class BucketedRatingIndex
+{
+public:
+	BucketedRatingIndex() : _buckets(MaxRating + 1) {}
+
+	void insert(std::size_t rating, PlayerName name)
+	{
+		_buckets[rating].insert(name);
+	}
+
+	void erase(std::size_t rating, PlayerName name)
+	{
+		if (rating <= MaxRating)
+			_buckets[rating].erase(name);
+	}
+
+	void insertSorted(const std::vector<RatingEntry>& entries)
+	{
+		for (const auto& entry : entries)
+			_buckets[entry.first].emplace_hint(_buckets[entry.first].end(), entry.second);
+	}
+
+	template <class Visitor>
+	bool visitDescending(std::size_t max, std::size_t min, Visitor visitor) const
+	{
+		if (min > MaxRating)
+			return false;
+		for (auto rating = std::min(max, MaxRating) + 1; rating-- > min;)
+		{
+			for (const auto& name : _buckets[rating])
+			{
+				if (visitor(rating, name))
+					return true;
+			}
+		}
+		return false;
+	}
+
+	template <class Visitor>
+	bool visitRating(std::size_t rating, Visitor visitor) const
+	{
+		return visitDescending(rating, rating, visitor);
+	}
+
+	template <class Visitor>
+	bool visitOutward(std::size_t center, std::size_t min, std::size_t max, Visitor visitor) const
+	{
+		max = std::min(max, MaxRating);
+		if (min > max)
+			return false;
+		center = std::min(std::max(center, min), max);
+		for (std::size_t distance = 0; center + distance <= max || center >= min + distance; ++distance)
+		{
+			if (center + distance <= max && visitRating(center + distance, visitor))
+				return true;
+			if (distance != 0 && center >= min + distance && visitRating(center - distance, visitor))
+				return true;
+		}
+		return false;
+	}
+private:
+	std::vector<std::set<PlayerName>> _buckets;
+};
+
+//A flat vector sorted by descending rating, then by name. Inserting and erasing move
+//elements around, but walks are sequential reads over contiguous memory.
+class SortedVectorRatingIndex
+{
+public:
+	void insert(std::size_t rating, PlayerName name)
+	{
+		auto entry = std::make_pair(rating, name);
+		const auto iter = std::lower_bound(_entries.begin(), _entries.end(), entry, Compare());
+		if (iter == _entries.end() || *iter != entry)
+			_entries.insert(iter, std::move(entry));
+	}
+
+	void erase(std::size_t rating, PlayerName name)
+	{
+		const auto entry = std::make_pair(rating, name);
+		const auto iter = std::lower_bound(_entries.begin(), _entries.end(), entry, Compare());
+		if (iter != _entries.end() && *iter == entry)
+			_entries.erase(iter);
+	}
+
+	void insertSorted(const std::vector<RatingEntry>& entries)
+	{
+		const auto middle = _entries.insert(_entries.end(), entries.begin(), entries.end());
+		std::inplace_merge(_entries.begin(), middle, _entries.end(), RatingEntryOrder());
+		_entries.erase(std::unique(_entries.begin(), _entries.end()), _entries.end());
+	}
+
+	template <class Visitor>
+	bool visitDescending(std::size_t max, std::size_t min, Visitor visitor) const
+	{
+		const auto first = std::lower_bound(_entries.begin(), _entries.end(), max,
+				[](const Entry& entry, std::size_t rating) {return entry.first > rating;});
+		for (auto iter = first; iter != _entries.end() && iter->first >= min; ++iter)
+		{
+			if (visitor(iter->first, iter->second))
+				return true;
+		}
+		return false;
+	}
+
+	template <class Visitor>
+	bool visitRating(std::size_t rating, Visitor visitor) const
+	{
+		return visitDescending(rating, rating, visitor);
+	}
+
+	template <class Visitor>
+	bool visitOutward(std::size_t center, std::size_t min, std::size_t max, Visitor visitor) const
+	{
+		if (min > max)
+			return false;
+		center = std::min(std::max(center, min), max);
+
+		const auto above = [](const Entry& entry, std::size_t rating) {return entry.first > rating;};
+		//[begin, up) are above center and [down, end) aren't
+		auto down = std::lower_bound(_entries.begin(), _entries.end(), center, above);
+		auto up = down;
+		for (;;)
+		{
+			const bool has_up = up != _entries.begin() && std::prev(up)->first <= max;
+			const bool has_down = down != _entries.end() && down->first >= min;
+			if (!has_up && !has_down)
+				return false;
+			if (has_up && (!has_down || std::prev(up)->first - center <= center - down->first))
+			{
+				//Visit the whole bucket in name order, like the other walks do
+				const auto rating = std::prev(up)->first;
+				const auto first = std::lower_bound(_entries.begin(), up, rating, above);
+				for (auto iter = first; iter != up; ++iter)
+				{
+					if (visitor(iter->first, iter->second))
+						return true;
+				}
+				up = first;
+			}
+			else
+			{
+				if (visitor(down->first, down->second))
+					return true;
+				++down;
+			}
+		}
+	}
+private:
+	using Entry = RatingEntry;
+	using Compare = RatingEntryOrder;
+
+	std::vector<Entry> _entries;
+};
@@ -0,0 +1,65 @@
+#include "region.hpp"
+
+#include <array>
+
+namespace
+{
+	//ISO 3166-1 alpha-2 codes of each region, in the order of Region
+	const char* const region_countries[region_count] =
+	{
+		//Africa
+		"DZAOBJBWBFBICVCMCFTDKMCGCDCIDJEGGQERSZETGAGMGHGNGWKELSLRLYMGMWMLMRMUYTMAMZNANENGRERWSHSTSNSCSLSOZASSSDTZTGTNUGEHZMZW",
+		//Asia
+		"AFAMAZBHBDBTBNKHCNCYGEHKINIDIRIQILJPJOKZKWKGLALBMOMYMVMNMMNPKPOMPKPSPHQASASGKRLKSYTWTJTHTLTRTMAEUZVNYEIOCCCX",
+		//Europe
+		"AXALADATBYBEBABGHRCZDKEEFOFIFRDEGIGRGGVAHUISIEIMITJELVLILTLUMTMDMCMENLMKNOPLPTRORUSMRSSKSIESSJSECHUAGB",
+		//North America
+		"AIAGAWBSBBBZBMBQVGCAKYCRCUCWDMDOSVGLGDGPGTHTHNJMMQMXMSNIPAPRBLKNLCMFPMVCSXTTTCUSVIUM",
+		//South America
+		"ARBOBVBRCLCOECFKGFGYPYPESRUYVEGS",
+		//Oceania
+		"ASAUCKFJPFGUHMKIMHFMNRNCNZNUNFMPPWPGPNWSSBTKTOTVVUWF"
+	};
+
+	using RegionTable = std::array<Region, 26 * 26>;
+
+	std::size_t slot(char first, char second)
+	{
+		return static_cast<std::size_t>(first - 'A') * 26 + static_cast<std::size_t>(second - 'A');
+	}
+
+	RegionTable makeRegionTable()
+	{
+		RegionTable table;
+		table.fill(Region::Unknown);
+		for (std::size_t region = 0; region < region_count; ++region)
+		{
+			for (auto code = region_countries[region]; code[0] != '\0'; code += 2)
+				table[slot(code[0], code[1])] = static_cast<Region>(region);
+		}
+		return table;
+	}
+}
+
+Region regionOf(const CountryCode& country)
+{
+	static const RegionTable table = makeRegionTable();
+
+	if (country[0] < 'A' || country[0] > 'Z' || country[1] < 'A' || country[1] > 'Z')
+		return Region::Unknown;
+	return table[slot(country[0], country[1])];
+}
+
+const char* regionName(const Region region)
+{
+	switch (region)
+	{
+		case Region::Africa:       return "africa";
+		case Region::Asia:         return "asia";
+		case Region::Europe:       return "europe";
+		case Region::NorthAmerica: return "north_america";
+		case Region::SouthAmerica: return "south_america";
+		case Region::Oceania:      return "oceania";
+		default:                   return "unknown";
+	}
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "player.hpp"
+
+//Continents used for region-aware matching. Players of the same region are more likely to
+//have a short round trip between them.
+enum class Region : std::uint8_t
+{
+	Africa,
+	Asia,
+	Europe,
+	NorthAmerica,
+	SouthAmerica,
+	Oceania,
+	Unknown		//Codes that aren't assigned or don't belong to a continent (e.g. AQ)
+};
+
+constexpr std::size_t region_count = static_cast<std::size_t>(Region::Unknown);	//Known regions
+
+Region regionOf(const CountryCode& country);
+const char* regionName(Region region);
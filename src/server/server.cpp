@@ -1,17 +1,147 @@
 #include "server.hpp"
 #include "manager.hpp"
+#include "logger.hpp"
+#include "stall_detector.hpp"
 
 #include <boost/asio/deadline_timer.hpp>
-#include <boost/asio/read_until.hpp>
 #include <boost/asio/write.hpp>
 #include <boost/system/error_code.hpp>
 
+#include <boost/asio/post.hpp>
+#include <boost/asio/signal_set.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <memory>
 
-PlayerSession::PlayerSession(boost::asio::ip::tcp::socket activeSocket) :
+#include <csignal>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+	std::atomic<std::uint64_t> next_session_id(1);
+
+	const SharedBuffer line_break = makeBuffer("\n");
+
+	//Asio recycles handler memory per thread, so a pending wait could keep a block sized for a
+	//previous write. Readiness waits of idle sessions get their own exact-size allocation.
+	template <class T>
+	struct ExactAllocator
+	{
+		using value_type = T;
+
+		ExactAllocator() = default;
+		template <class U>
+		ExactAllocator(const ExactAllocator<U>&) {}
+
+		T* allocate(std::size_t n) {return static_cast<T*>(::operator new(n * sizeof(T)));}
+		void deallocate(T* ptr, std::size_t) {::operator delete(ptr);}
+
+		template <class U>
+		bool operator==(const ExactAllocator<U>&) const {return true;}
+		template <class U>
+		bool operator!=(const ExactAllocator<U>&) const {return false;}
+	};
+
+	template <class Handler>
+	struct ExactAllocHandler
+	{
+		using allocator_type = ExactAllocator<void>;
+		allocator_type get_allocator() const {return allocator_type();}
+
+		template <class... Args>
+		void operator()(Args&&... args) {handler(std::forward<Args>(args)...);}
+
+		Handler handler;
+	};
+
+	template <class Handler>
+	ExactAllocHandler<Handler> exactAlloc(Handler handler)
+	{
+		return ExactAllocHandler<Handler>{std::move(handler)};
+	}
+
+	//Keeps a few objects released by sessions going idle, so the next request of any session
+	//reuses them instead of allocating. Sessions of an io_context run on the thread running it,
+	//hence one per thread.
+	template <class T, std::size_t Capacity>
+	class Recycler
+	{
+	public:
+		static Recycler& local()
+		{
+			thread_local Recycler instance;
+			return instance;
+		}
+
+		template <class... Args>
+		std::unique_ptr<T> take(Args&&... args)
+		{
+			if (_count == 0)
+				return std::make_unique<T>(std::forward<Args>(args)...);
+			return std::move(_free[--_count]);
+		}
+
+		void give(std::unique_ptr<T> object)
+		{
+			if (_count < Capacity)
+				_free[_count++] = std::move(object);
+		}
+	private:
+		std::array<std::unique_ptr<T>, Capacity> _free;
+		std::size_t _count = 0;
+	};
+
+	constexpr std::size_t recycled_objects = 16;
+	constexpr std::size_t max_recycled_buffers = 64;	//An outbox that queued more isn't kept
+
+	using RequestBuffers = Recycler<boost::asio::streambuf, recycled_objects>;
+
+	//A buffer sequence over the gather list of an outbox: async_write would copy a vector
+	class GatherView
+	{
+	public:
+		using value_type = boost::asio::const_buffer;
+		using const_iterator = const boost::asio::const_buffer*;
+
+		explicit GatherView(const std::vector<boost::asio::const_buffer>& buffers) :
+			_begin(buffers.data()),
+			_end(buffers.data() + buffers.size())
+		{
+		}
+
+		const_iterator begin() const {return _begin;}
+		const_iterator end() const {return _end;}
+	private:
+		const_iterator _begin;
+		const_iterator _end;
+	};
+
+	bool resourceExhausted(const boost::system::error_code& errorCode)
+	{
+		using boost::system::errc::errc_t;
+		return errorCode == errc_t::too_many_files_open || errorCode == errc_t::too_many_files_open_in_system
+			|| errorCode == errc_t::no_buffer_space || errorCode == errc_t::not_enough_memory;
+	}
+
+#if defined(BOOST_ASIO_HAS_EPOLL)
+	const char* const reactor_name = "epoll";
+#elif defined(BOOST_ASIO_HAS_KQUEUE)
+	const char* const reactor_name = "kqueue";
+#else
+	const char* const reactor_name = "select";
+#endif
+}
+
+PlayerSession::PlayerSession(SessionSocket activeSocket) :
 	_active_socket(std::move(activeSocket)),
-	_timer(boost::asio::deadline_timer(Server::instance().ioContext())),
-	_close_socket(false)
+	_session_id(next_session_id.fetch_add(1, std::memory_order_relaxed)),
+	_close_socket(false),
+	_read_pending(false)
 {
 }
 
@@ -27,7 +157,7 @@ void PlayerSession::closeSocket()
 		return;
 	}
 
-	_active_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both);
+	_active_socket.shutdown(SessionSocket::shutdown_both);
 	_active_socket.close();
 }
 
@@ -38,129 +168,297 @@ PlayerSession::~PlayerSession()
 
 boost::asio::deadline_timer::duration_type PlayerSession::deadline() const
 {
-	return _timer.expires_from_now();
-	//return boost::asio::deadline_timer::duration_type();
+	if (!_timer)
+		return boost::asio::deadline_timer::duration_type();
+	return _timer->expires_from_now();
 }
 
 void PlayerSession::waitForAMatch() 
 {
-	_timer.expires_from_now(boost::posix_time::seconds(wait_timeout));
+	if (!_timer)
+		_timer = std::make_unique<boost::asio::deadline_timer>(_active_socket.get_executor());
+	_timer->expires_from_now(boost::posix_time::seconds(wait_timeout));
 
 	using boost::system::error_code;
-	const auto callback = [this](const error_code& errorCode)
+	std::weak_ptr<PlayerSession> weak_self = shared_from_this();
+	const auto callback = [weak_self](const error_code& errorCode)
 	{
 		const auto canceled = [](const boost::system::error_code& errorCode)
 		{
 			return errorCode.value() == boost::system::errc::operation_canceled;
 		};
 
-		const auto isSingleAndOnline = [](const std::string& name)
+		const auto isSingleAndOnline = [](PlayerName name)
 		{
 			return Manager::instance().isOnline(name) && !Manager::instance().hasMatch(name);
 		};
 
-		if (!canceled(errorCode) && isSingleAndOnline(name()))
-			sendMessage("There is no suitable opponent. Please try later");
+		//The session may be gone when the wait is aborted
+		const auto self = weak_self.lock();
+		if (canceled(errorCode) || !self)
+			return;
+		StallDetector::HandlerScope scope("match_timeout", 13, self->_session_id);
+		if (isSingleAndOnline(self->name()))
+			self->sendMessage("There is no suitable opponent. Please try later");
 	};
-	_timer.async_wait(callback);
+	_timer->async_wait(callback);
+}
+
+bool PlayerSession::waitForARegionalMatch()
+{
+	if (!_timer)
+		_timer = std::make_unique<boost::asio::deadline_timer>(_active_socket.get_executor());
+	_timer->expires_from_now(boost::posix_time::seconds(region_timeout));
+
+	std::weak_ptr<PlayerSession> weak_self = shared_from_this();
+	_timer->async_wait([weak_self](const boost::system::error_code& errorCode)
+	{
+		const auto self = weak_self.lock();
+		if (errorCode || !self)
+			return;
+		StallDetector::HandlerScope scope("region_timeout", 14, self->_session_id);
+		Manager::instance().widenMatch(self);
+	});
+	return true;
 }
 
 void PlayerSession::cancelWaiting()
 {
-	_timer.cancel();
+	if (_timer)
+		_timer->cancel();
 }
 
-void PlayerSession::sendMessage(const std::string& message)
+void PlayerSession::sendMessage(Message message)
 {
-	std::ostream os(&_response);
-	os << message << std::endl;
-	write();
+	if (!_outbox)
+		_outbox = Recycler<Outbox, recycled_objects>::local().take();
+	auto& pending = _outbox->pending;
+	const bool write_in_progress = !_outbox->writing.empty();
+	if (pending.empty())
+		pending.reserve(message.size() + 1);
+	pending.insert(pending.end(), std::make_move_iterator(message.begin()), std::make_move_iterator(message.end()));
+	pending.push_back(line_break);
+	if (!write_in_progress)
+		write();
 }
 
 void PlayerSession::start()
 {
+	//Only affects synchronous operations: reads after a readiness notification must not block
+	_active_socket.non_blocking(true);
 	read();
 }
 
+//Idle sessions wait for readiness instead of keeping a receive buffer in a pending read
 void PlayerSession::read()
 {
 	auto self(shared_from_this());
-	const auto handler = [this, self](const boost::system::error_code& errorCode, std::size_t /*bytesTransfered*/)
+	_read_pending = true;
+
+	if (_request)
 	{
-		if (errorCode)
+		const auto data = static_cast<const char*>(_request->data().data());
+		if (std::find(data, data + _request->size(), '\n') != data + _request->size())
 		{
-			//TODO error handling please!
+			boost::asio::post(_active_socket.get_executor(), [this, self]()
+			{
+				onReadable(boost::system::error_code());
+			});
 			return;
 		}
-		std::string line;
-		std::istream is(&_request);
-		std::getline(is, line);
-		Manager::instance().parseCsv(self, line);
-		//Manager::instance().logIn(self);
-	};
+	}
 
-	boost::asio::async_read_until(_active_socket, _request, "\n", handler);
+	_active_socket.async_wait(SessionSocket::wait_read, exactAlloc([this, self](const boost::system::error_code& errorCode)
+	{
+		onReadable(errorCode);
+	}));
 }
 
+void PlayerSession::onReadable(boost::system::error_code errorCode)
+{
+	_read_pending = false;
+
+	std::string line;
+	if (!errorCode && !takeLine(line))
+	{
+		if (!_request)
+			_request = RequestBuffers::local().take(max_request_size);
+		const auto space = _request->max_size() - _request->size();
+		if (space == 0)
+		{
+			logEvent(LogLevel::Warning, "request_too_long", _session_id);
+			closeSocket();
+			return;
+		}
+		const auto size = _active_socket.read_some(_request->prepare(std::min<std::size_t>(space, 512)), errorCode);
+		_request->commit(size);
+		if (errorCode == boost::asio::error::would_block)
+			errorCode.clear();
+		if (!errorCode && !takeLine(line))
+		{
+			read();
+			return;
+		}
+	}
+	if (errorCode)
+	{
+		//Every disconnect ends here: don't build the message unless it's logged
+		const auto level = errorCode == boost::asio::error::eof ? LogLevel::Debug : LogLevel::Warning;
+		if (Logger::instance().enabled(level))
+			Logger::instance().log(level, "read_failed", _session_id, nullptr, errorCode.message());
+		return;
+	}
+	StallDetector::HandlerScope scope(line.data(), std::min(line.find(','), line.size()), _session_id);
+	Manager::instance().parseCsv(shared_from_this(), line);
+}
+
+//Moves the first complete line of the receive buffer to `line`. The buffer is recycled
+//once it's empty.
+bool PlayerSession::takeLine(std::string& line)
+{
+	if (!_request)
+		return false;
+	const auto data = static_cast<const char*>(_request->data().data());
+	const auto end  = data + _request->size();
+	const auto pos  = std::find(data, end, '\n');
+	if (pos == end)
+		return false;
+	line.assign(data, pos);
+	_request->consume(pos - data + 1);
+	if (_request->size() == 0)
+		RequestBuffers::local().give(std::move(_request));
+	return true;
+}
+
+//Messages are written as one gather list of shared buffers: nothing is copied on the way
+//from the manager to the socket. Messages queued while a write is in flight go out next.
 void PlayerSession::write()
 {
-	const auto handler = [this](const boost::system::error_code& errorCode, std::size_t /*bytesTransfered*/)
+	auto& outbox = *_outbox;
+	outbox.writing.swap(outbox.pending);
+	outbox.gather.clear();
+	outbox.gather.reserve(outbox.writing.size());
+	for (const auto& buffer : outbox.writing)
+		outbox.gather.push_back(boost::asio::buffer(*buffer));
+
+	auto self(shared_from_this());
+	const auto handler = [this, self](const boost::system::error_code& errorCode, std::size_t /*bytesTransfered*/)
 	{
+		_outbox->writing.clear();
 		if (errorCode)
 		{
-			//TODO error handling pelase!
+			logEvent(LogLevel::Warning, "write_failed", _session_id, nullptr, errorCode.message());
+			return;
+		}
+		if (!_outbox->pending.empty())
+		{
+			write();
 			return;
 		}
+		_outbox->gather.clear();
+		if (_outbox->pending.capacity() <= max_recycled_buffers)
+			Recycler<Outbox, recycled_objects>::local().give(std::move(_outbox));
+		_outbox.reset();
 		if (_close_socket)
 		{
 			closeSocket();
 			return;
 		}
-		read();
+		//A notification for this player (e.g. a pairing) may be written while a read is pending
+		if (!_read_pending)
+			read();
 	};
 
-	if (_close_socket)
-	{
-		auto self(shared_from_this());
-		const auto keepSessionAliveUntilWrite = [this, self, handler](const boost::system::error_code& errorCode, std::size_t bytesTransfered)
-		{
-			handler(errorCode, bytesTransfered);
-		};
-		boost::asio::async_write(_active_socket, _response, keepSessionAliveUntilWrite);
-	}
-	else
-		boost::asio::async_write(_active_socket, _response, handler);
+	boost::asio::async_write(_active_socket, GatherView(outbox.gather), handler);
 }
 
 Server::Server(short int port) :
 	_acceptor(_io_context, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port)),
-	_socket(_io_context)
+	_socket(_io_context),
+	_accept_retry(_io_context),
+	_local_socket(_io_context),
+	_local_accept_retry(_io_context)
 {
-	accept();
+	accept(_acceptor, _socket, _accept_retry);
+}
+
+void Server::listenLocal(const std::string& path)
+{
+	//Only a socket left by a previous run is removed, never a file given by mistake nor the
+	//socket of a server still running: a stale socket refuses connections
+	struct stat status;
+	if (::lstat(path.c_str(), &status) == 0)
+	{
+		if (!S_ISSOCK(status.st_mode))
+			throw boost::system::system_error(boost::system::errc::make_error_code(boost::system::errc::file_exists), "not a socket");
+		boost::asio::local::stream_protocol::socket probe(_io_context);
+		boost::system::error_code errorCode;
+		probe.connect(boost::asio::local::stream_protocol::endpoint(path), errorCode);
+		if (!errorCode)
+			throw boost::system::system_error(boost::system::errc::make_error_code(boost::system::errc::address_in_use), "in use by a running server");
+		if (errorCode != boost::asio::error::connection_refused)
+			throw boost::system::system_error(errorCode, "can't check whether the socket is stale");
+		::unlink(path.c_str());
+	}
+	_local_acceptor.emplace(_io_context, boost::asio::local::stream_protocol::endpoint(path));
+	_local_path = path;
+	logEvent(LogLevel::Info, "listening_local", 0, nullptr, path);
+	accept(*_local_acceptor, _local_socket, _local_accept_retry);
 }
 
 //TODO A user can establish a connection and then do nothing afterwards. A simple solution
 //is to add a deadline timer to make sure a user cannot be idle more than a specific seconds
-void Server::accept()
+template <class Acceptor, class Socket>
+void Server::accept(Acceptor& acceptor, Socket& socket, boost::asio::steady_timer& retryTimer)
 {
-	const auto handler = [this](const boost::system::error_code& errorCode)
+	const auto handler = [this, &acceptor, &socket, &retryTimer](const boost::system::error_code& errorCode)
 	{
-		std::cout << "accepting a new connection" << std::endl;
 		if (errorCode)
 		{
-			//TODO error handling please!
-			std::cerr << "error in accpet handler" << std::endl;
+			if (errorCode == boost::asio::error::operation_aborted)
+				return;
+			logEvent(LogLevel::Error, "accept_failed", 0, nullptr, errorCode.message());
+			//Transient errors shouldn't stop the server. Out of descriptors or memory, the
+			//pending connection stays in the listen queue: accepting again right away would spin.
+			if (resourceExhausted(errorCode))
+			{
+				retryTimer.expires_after(std::chrono::milliseconds(accept_retry_ms));
+				retryTimer.async_wait([this, &acceptor, &socket, &retryTimer](const boost::system::error_code& errorCode)
+				{
+					if (!errorCode)
+						accept(acceptor, socket, retryTimer);
+				});
+				return;
+			}
+			accept(acceptor, socket, retryTimer);
 			return;
 		}
-		std::make_shared<PlayerSession>(std::move(_socket))->start();
-		accept();
+		auto session = std::make_shared<PlayerSession>(SessionSocket(std::move(socket)));
+		logEvent(LogLevel::Debug, "accept", session->sessionId());
+		session->start();
+		accept(acceptor, socket, retryTimer);
 	};
 
-	_acceptor.async_accept(_socket, handler);
+	acceptor.async_accept(socket, handler);
 }
 
 void Server::run()
 {
-	std::cout << "Listening for incoming messages" << std::endl;
+	boost::asio::signal_set signals(_io_context, SIGINT, SIGTERM);
+	signals.async_wait([this](const boost::system::error_code& errorCode, int signal)
+	{
+		if (errorCode)
+			return;
+		logEvent(LogLevel::Info, "shutdown", 0, nullptr, nullptr, signal);
+		_io_context.stop();
+	});
+
+	logEvent(LogLevel::Info, "listening", 0, nullptr, reactor_name, _acceptor.local_endpoint().port());
 	_io_context.run();
+
+	if (_local_acceptor)
+	{
+		_local_acceptor->close();
+		::unlink(_local_path.c_str());
+	}
 }
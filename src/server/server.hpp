@@ -1,40 +1,72 @@
 #pragma once
 
 #include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
 #include <boost/asio/streambuf.hpp>
+#include <boost/optional.hpp>
 #include <cstdlib>
 #include <iostream>
 #include <memory>
+#include <string>
 #include <utility>
+#include <vector>
 #include <boost/asio/ts/buffer.hpp>
 #include <boost/asio/ts/internet.hpp>
 
 #include "player.hpp"
 
 #define wait_timeout 60
+#define region_timeout 5	//Seconds a regional match waits before looking in every region
+#define max_request_size 4096
+#define accept_retry_ms 100	//Delay before accepting again after running out of descriptors or memory
+
+//Sessions work the same over TCP and Unix domain sockets
+using SessionSocket = boost::asio::generic::stream_protocol::socket;
 
 class PlayerSession : public std::enable_shared_from_this<PlayerSession>, public Player
 {
 public:
-	PlayerSession(boost::asio::ip::tcp::socket activeSocket);
+	PlayerSession(SessionSocket activeSocket);
 	void start();
 	virtual void waitForAMatch() override;
+	virtual bool waitForARegionalMatch() override;
 	virtual void cancelWaiting() override;
-	virtual void sendMessage(const std::string& message) override;
+	using Player::sendMessage;
+	virtual void sendMessage(Message message) override;
 	virtual boost::asio::deadline_timer::duration_type deadline() const override;
 	virtual void logout() override;
+	virtual std::uint64_t sessionId() const override {return _session_id;}
 	virtual ~PlayerSession();
 private:
 	void read();
+	void onReadable(boost::system::error_code errorCode);
+	bool takeLine(std::string& line);
 	void write();
 	void closeSocket();
 
-	boost::asio::ip::tcp::socket _active_socket;
-	boost::asio::deadline_timer _timer;
-	boost::asio::streambuf _request;
-	boost::asio::streambuf _response;
+	//Messages waiting to be written and the write in flight. Only exists while there is
+	//something to send.
+	struct Outbox
+	{
+		Message pending;	//Queued while a write is in flight
+		Message writing;	//Owns the buffers of the write in flight
+		std::vector<boost::asio::const_buffer> gather;
+	};
+
+	//An idle session only owns its socket: the receive buffer is taken once the socket is
+	//readable and given back as soon as it's empty, the outbox while there is something to
+	//send and the timer is allocated the first time the player waits for a match. Buffers
+	//given back are recycled by the next sessions, a few of them per thread.
+	SessionSocket _active_socket;
+	std::unique_ptr<boost::asio::deadline_timer> _timer;
+	std::unique_ptr<boost::asio::streambuf> _request;
+	std::unique_ptr<Outbox> _outbox;
+	std::uint64_t _session_id;
 	bool _close_socket;
+	bool _read_pending;
 };
 
 class Server
@@ -45,14 +77,27 @@ public:
 		static Server instance(7777);
 		return instance;
 	}
+	//Returns after SIGINT or SIGTERM
 	void run();
+	//Also accepts sessions on a Unix domain socket, for clients on the same host. A stale
+	//socket at path (one that refuses connections) is removed, and the socket is removed when
+	//run returns. Throws boost::system::system_error on failure, e.g. if path exists and isn't
+	//a socket, or another server accepts connections on it.
+	void listenLocal(const std::string& path);
 	boost::asio::io_context& ioContext() {return _io_context;}
 private:
 	Server(short int port);
 	//Handler when OS create an active socket when the passive socket receive a request
-	void accept();
+	template <class Acceptor, class Socket>
+	void accept(Acceptor& acceptor, Socket& socket, boost::asio::steady_timer& retryTimer);
 	
 	boost::asio::io_context        _io_context;
 	boost::asio::ip::tcp::acceptor _acceptor;
 	boost::asio::ip::tcp::socket   _socket;
+	boost::asio::steady_timer      _accept_retry;
+
+	boost::optional<boost::asio::local::stream_protocol::acceptor> _local_acceptor;
+	boost::asio::local::stream_protocol::socket _local_socket;
+	boost::asio::steady_timer _local_accept_retry;
+	std::string _local_path;
 };
@@ -0,0 +1,262 @@
+#include "stall_detector.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+
+#include <boost/asio/post.hpp>
+
+namespace
+{
+	std::int64_t steadyMicroseconds()
+	{
+		using namespace std::chrono;
+		return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+	}
+
+	std::int64_t systemMicroseconds()
+	{
+		using namespace std::chrono;
+		return duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+	}
+}
+
+constexpr std::size_t StallDetector::histogram_size;
+constexpr std::size_t StallDetector::ring_size;
+
+StallDetector& StallDetector::instance()
+{
+	static StallDetector instance;
+	return instance;
+}
+
+StallDetector::StallDetector() :
+	_running(false),
+	_threshold_us(0),
+	_probe_interval(0),
+	_report_interval(0),
+	_io(nullptr),
+	_handler_generation(0),
+	_handler_start_us(0),
+	_handler_session(0),
+	_sampled_start_us(0),
+	_max_lag_us(0),
+	_slow_handler_count(0)
+{
+	for (auto& word : _handler_command)
+		word.store(0, std::memory_order_relaxed);
+	for (auto& bucket : _lag_histogram)
+		bucket.store(0, std::memory_order_relaxed);
+}
+
+StallDetector::~StallDetector()
+{
+	stop();
+}
+
+void StallDetector::start(boost::asio::io_context& io, const std::chrono::milliseconds probeInterval, const std::chrono::milliseconds threshold,
+		const std::string& reportPath, const std::chrono::seconds reportInterval)
+{
+	if (_running.exchange(true))
+		return;
+	_io              = &io;
+	_probe_interval  = probeInterval;
+	_threshold_us    = std::chrono::duration_cast<std::chrono::microseconds>(threshold).count();
+	_report_path     = reportPath;
+	_report_interval = reportInterval;
+	_watchdog = std::thread([this](){watchdogLoop();});
+}
+
+void StallDetector::stop()
+{
+	{
+		std::lock_guard<std::mutex> guard(_stop_mutex);
+		if (!_running.exchange(false))
+			return;
+	}
+	_stop_cv.notify_all();
+	_watchdog.join();
+	writeReport();
+}
+
+StallDetector::HandlerScope::HandlerScope(const char* command, const std::size_t commandSize, const std::uint64_t session) :
+	_active(StallDetector::instance()._running.load(std::memory_order_relaxed))
+{
+	if (!_active)
+		return;
+	auto& detector = StallDetector::instance();
+
+	//The command comes from the client: anything that would break the space separated report
+	//or the command= log field is replaced
+	char packed[16] = {};
+	const auto size = std::min(commandSize, sizeof(packed) - 1);
+	for (std::size_t i = 0; i < size; ++i)
+		packed[i] = command[i] > ' ' && command[i] < 0x7f ? command[i] : '?';
+	const auto generation = detector._handler_generation.load(std::memory_order_relaxed);
+	detector._handler_generation.store(generation + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	for (std::size_t i = 0; i < detector._handler_command.size(); ++i)
+	{
+		std::uint64_t word;
+		std::memcpy(&word, packed + i * sizeof(word), sizeof(word));
+		detector._handler_command[i].store(word, std::memory_order_relaxed);
+	}
+	detector._handler_session.store(session, std::memory_order_relaxed);
+	detector._handler_start_us.store(steadyMicroseconds(), std::memory_order_relaxed);
+	detector._handler_generation.store(generation + 2, std::memory_order_release);
+}
+
+StallDetector::HandlerScope::~HandlerScope()
+{
+	if (!_active)
+		return;
+	auto& detector = StallDetector::instance();
+
+	HandlerSample sample;
+	detector.sampleHandler(sample);
+	detector._handler_start_us.store(0, std::memory_order_release);
+	const auto duration = steadyMicroseconds() - sample.start_us;
+	if (duration > detector._threshold_us)
+		detector.recordSlowHandler(sample, false, duration);
+}
+
+void StallDetector::sampleHandler(HandlerSample& sample) const
+{
+	for (;;)
+	{
+		const auto generation = _handler_generation.load(std::memory_order_acquire);
+		if (generation % 2 == 0)
+		{
+			sample.start_us = _handler_start_us.load(std::memory_order_relaxed);
+			sample.session  = _handler_session.load(std::memory_order_relaxed);
+			for (std::size_t i = 0; i < _handler_command.size(); ++i)
+			{
+				const auto word = _handler_command[i].load(std::memory_order_relaxed);
+				std::memcpy(sample.command + i * sizeof(word), &word, sizeof(word));
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (_handler_generation.load(std::memory_order_relaxed) == generation)
+				break;
+		}
+		std::this_thread::yield();
+	}
+	sample.command[sizeof(sample.command) - 1] = '\0';
+}
+
+void StallDetector::recordLag(const std::int64_t lag_us)
+{
+	std::size_t bucket = 0;
+	while (bucket + 1 < histogram_size && (std::int64_t(1) << bucket) < lag_us)
+		++bucket;
+	_lag_histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+
+	auto max = _max_lag_us.load(std::memory_order_relaxed);
+	while (lag_us > max && !_max_lag_us.compare_exchange_weak(max, lag_us, std::memory_order_relaxed));
+}
+
+void StallDetector::recordSlowHandler(const HandlerSample& sample, const bool running, const std::int64_t duration_us)
+{
+	SlowHandler entry;
+	entry.time_us     = systemMicroseconds();
+	entry.duration_us = duration_us;
+	entry.session     = sample.session;
+	entry.running     = running;
+	std::memcpy(entry.command, sample.command, sizeof(entry.command));
+
+	{
+		std::lock_guard<std::mutex> guard(_ring_mutex);
+		_slow_handlers[_slow_handler_count % ring_size] = entry;
+		++_slow_handler_count;
+	}
+	logEvent(LogLevel::Warning, running ? "stalled_handler" : "slow_handler", entry.session, entry.command, nullptr, duration_us);
+}
+
+void StallDetector::watchdogLoop()
+{
+	//Shared with the probes, which may outlive a stopped detector in the io_context's queue
+	const auto posted_at = std::make_shared<std::atomic<std::int64_t>>(0);
+	auto next_report = std::chrono::steady_clock::now() + _report_interval;
+
+	std::unique_lock<std::mutex> lock(_stop_mutex);
+	while (_running.load(std::memory_order_relaxed))
+	{
+		const auto posted = posted_at->load(std::memory_order_acquire);
+		if (posted == 0)
+		{
+			posted_at->store(steadyMicroseconds(), std::memory_order_release);
+			boost::asio::post(*_io, [this, posted_at]()
+			{
+				const auto lag = steadyMicroseconds() - posted_at->exchange(0, std::memory_order_acq_rel);
+				if (_running.load(std::memory_order_relaxed))
+					recordLag(lag);
+			});
+		}
+		else if (steadyMicroseconds() - posted > _threshold_us)
+		{
+			//The loop is stalled: sample the running handler once. It's recorded again with
+			//its full duration when it finishes.
+			HandlerSample sample;
+			sampleHandler(sample);
+			if (sample.start_us != 0 && sample.start_us != _sampled_start_us)
+			{
+				_sampled_start_us = sample.start_us;
+				recordSlowHandler(sample, true, steadyMicroseconds() - sample.start_us);
+			}
+		}
+
+		if (!_report_path.empty() && std::chrono::steady_clock::now() >= next_report)
+		{
+			lock.unlock();
+			writeReport();
+			lock.lock();
+			next_report = std::chrono::steady_clock::now() + _report_interval;
+		}
+		_stop_cv.wait_for(lock, _probe_interval);
+	}
+}
+
+void StallDetector::report(std::ostream& os) const
+{
+	os << "# event loop lag (microseconds)\n";
+	os << "# upper_bound count\n";
+	for (std::size_t i = 0; i < histogram_size; ++i)
+	{
+		const auto count = _lag_histogram[i].load(std::memory_order_relaxed);
+		if (count != 0)
+			os << (std::int64_t(1) << i) << ' ' << count << '\n';
+	}
+	os << "# max " << _max_lag_us.load(std::memory_order_relaxed) << "\n\n";
+
+	os << "# recent slow handlers, oldest first\n";
+	os << "# time_us command session duration_us state\n";
+	std::lock_guard<std::mutex> guard(_ring_mutex);
+	const auto count = std::min(_slow_handler_count, ring_size);
+	for (auto i = _slow_handler_count - count; i < _slow_handler_count; ++i)
+	{
+		const auto& entry = _slow_handlers[i % ring_size];
+		os << entry.time_us << ' ' << (entry.command[0] == '\0' ? "-" : entry.command) << ' ' << entry.session << ' '
+			<< entry.duration_us << ' ' << (entry.running ? "running" : "finished") << '\n';
+	}
+}
+
+//Written to a temporary file first so readers never see a partial report
+void StallDetector::writeReport()
+{
+	if (_report_path.empty())
+		return;
+	const auto tmp_path = _report_path + ".tmp";
+	{
+		std::ofstream os(tmp_path, std::ios::trunc);
+		report(os);
+		if (!os.flush())
+		{
+			logEvent(LogLevel::Error, "stall_report_failed", 0, nullptr, tmp_path);
+			return;
+		}
+	}
+	if (std::rename(tmp_path.c_str(), _report_path.c_str()) != 0)
+		logEvent(LogLevel::Error, "stall_report_failed", 0, nullptr, _report_path);
+}
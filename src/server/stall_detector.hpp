@@ -0,0 +1,99 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <boost/asio/io_context.hpp>
+
+//Measures event loop lag and attributes it to handlers. A watchdog thread posts a probe to
+//the io_context every probe interval and records how long it waited to run in a histogram.
+//Handlers running on the event loop are wrapped in a HandlerScope: one that runs longer than
+//the threshold is recorded in a ring of recent slow handlers, and so is the handler running
+//when a probe has been waiting longer than the threshold (e.g. a handler blocked on a lock).
+class StallDetector
+{
+public:
+	static StallDetector& instance();
+
+	//The report (lag histogram and slow handlers) is rewritten every report interval if a
+	//path is given
+	void start(boost::asio::io_context& io, std::chrono::milliseconds probeInterval, std::chrono::milliseconds threshold,
+			const std::string& reportPath, std::chrono::seconds reportInterval);
+	void stop();
+
+	void report(std::ostream& os) const;
+
+	//Marks a handler running on the event loop thread. Command is truncated to 15 characters.
+	class HandlerScope
+	{
+	public:
+		HandlerScope(const char* command, std::size_t commandSize, std::uint64_t session);
+		~HandlerScope();
+		HandlerScope(const HandlerScope&) = delete;
+		HandlerScope& operator=(const HandlerScope&) = delete;
+	private:
+		bool _active;
+	};
+
+	~StallDetector();
+private:
+	StallDetector();
+	void watchdogLoop();
+	void recordLag(std::int64_t lag_us);
+	struct HandlerSample
+	{
+		std::int64_t  start_us;
+		std::uint64_t session;
+		char          command[16];
+	};
+	//A consistent copy of the running handler, retried while a HandlerScope replaces it
+	void sampleHandler(HandlerSample& sample) const;
+	void recordSlowHandler(const HandlerSample& sample, bool running, std::int64_t duration_us);
+	void writeReport();
+
+	static constexpr std::size_t histogram_size = 26;	//Powers of two up to ~33 seconds
+	static constexpr std::size_t ring_size      = 64;
+
+	struct SlowHandler
+	{
+		std::int64_t  time_us;	//When it was recorded (system clock)
+		std::int64_t  duration_us;
+		std::uint64_t session;
+		char          command[16];
+		bool          running;	//Sampled by the watchdog while it was still running, so the
+					//duration is how long it had been running
+	};
+
+	std::atomic<bool> _running;
+	std::int64_t _threshold_us;
+	std::chrono::milliseconds _probe_interval;
+	std::chrono::seconds _report_interval;
+	std::string _report_path;
+	boost::asio::io_context* _io;
+	std::thread _watchdog;
+	std::mutex _stop_mutex;
+	std::condition_variable _stop_cv;
+
+	//The handler currently running on the event loop, written by HandlerScope. The generation
+	//is odd while a HandlerScope is replacing the fields, so the watchdog never records the
+	//command of one handler with the session of another.
+	std::atomic<std::uint64_t> _handler_generation;
+	std::atomic<std::int64_t>  _handler_start_us;	//0 when no handler is running
+	std::atomic<std::uint64_t> _handler_session;
+	std::array<std::atomic<std::uint64_t>, 2> _handler_command;	//Packed characters
+	std::int64_t _sampled_start_us;	//Watchdog only: the last handler it sampled
+
+	std::array<std::atomic<std::uint64_t>, histogram_size> _lag_histogram;
+	std::atomic<std::int64_t> _max_lag_us;
+
+	mutable std::mutex _ring_mutex;
+	std::array<SlowHandler, ring_size> _slow_handlers;
+	std::size_t _slow_handler_count;
+};
@@ -0,0 +1,306 @@
+//Reports the heap memory an idle session costs the server: a connected PlayerSession with
+//its pending readiness wait and, unless --no-login is given, the manager's entries for a
+//logged in player. Sessions are real loopback connections. Kernel socket memory isn't
+//included.
+//
+//The server's rating index costs a node per logged in player and nothing per rating, so
+//--ratings, the number of distinct ratings, shouldn't change the per-session figure; other
+//indexes (see rating_index.hpp) keep buckets per rating.
+//
+//--match reports what a pairing costs instead: pairs of players log in one pair at a time
+//and the first of each sends a match request, which pairs it with the second since the
+//earlier pairs aren't single anymore. Only the server's handling of the request is counted.
+//
+//--sessionless logs players in without sockets and only counts the manager's share (the
+//descriptor and the manager's entries), so it isn't limited by the number of descriptors.
+//Adding the --no-login figure gives the cost of a session at that scale.
+
+#include <boost/asio/connect.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/program_options.hpp>
+
+#include <cstdlib>
+#include <iostream>
+#include <malloc.h>
+#include <new>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+#include "server/manager.hpp"
+#include "server/server.hpp"
+
+namespace
+{
+	//Every block starts with a header, so a block allocated while counting is still
+	//accounted for when it's freed later
+	struct alignas(16) BlockHeader
+	{
+		std::size_t size;
+		bool counted;
+	};
+
+	bool counting = false;
+	std::size_t live_bytes  = 0;	//As requested
+	std::size_t live_usable = 0;	//As handed out by malloc
+	std::size_t live_blocks = 0;
+	std::size_t allocations = 0;	//Every block allocated while counting, freed or not
+	std::size_t allocated_bytes = 0;
+
+	void* allocate(std::size_t size)
+	{
+		auto header = static_cast<BlockHeader*>(std::malloc(sizeof(BlockHeader) + size));
+		if (header == nullptr)
+			throw std::bad_alloc();
+		header->size    = size;
+		header->counted = counting;
+		if (counting)
+		{
+			live_bytes  += size;
+			live_usable += malloc_usable_size(header) - sizeof(BlockHeader);
+			++live_blocks;
+			++allocations;
+			allocated_bytes += size;
+		}
+		return header + 1;
+	}
+
+	void deallocate(void* ptr) noexcept
+	{
+		if (ptr == nullptr)
+			return;
+		auto header = static_cast<BlockHeader*>(ptr) - 1;
+		if (header->counted)
+		{
+			live_bytes  -= header->size;
+			live_usable -= malloc_usable_size(header) - sizeof(BlockHeader);
+			--live_blocks;
+		}
+		std::free(header);
+	}
+
+	struct Counting
+	{
+		Counting() {counting = true;}
+		~Counting() {counting = false;}
+	};
+
+	std::size_t raiseFileLimit()
+	{
+		rlimit limit;
+		if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+			return 1024;
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+		getrlimit(RLIMIT_NOFILE, &limit);
+		return limit.rlim_cur;
+	}
+}
+
+void* operator new(std::size_t size) {return allocate(size);}
+void* operator new[](std::size_t size) {return allocate(size);}
+void operator delete(void* ptr) noexcept {deallocate(ptr);}
+void operator delete[](void* ptr) noexcept {deallocate(ptr);}
+void operator delete(void* ptr, std::size_t) noexcept {deallocate(ptr);}
+void operator delete[](void* ptr, std::size_t) noexcept {deallocate(ptr);}
+
+int main(int argc, char* argv[])
+{
+	namespace po = boost::program_options;
+	using boost::asio::ip::tcp;
+
+	//Both ends of every connection live in this process
+	const auto max_sessions = (raiseFileLimit() - 32) / 2;
+
+	std::size_t sessions, ratings;
+	po::options_description desc("Options");
+	desc.add_options()
+		("help,h", "Print this help message")
+		("sessions", po::value<std::size_t>(&sessions)->default_value(std::min<std::size_t>(10000, max_sessions)), "Number of idle sessions")
+		("ratings", po::value<std::size_t>(&ratings)->default_value(2900), "Distinct ratings among the logged in players (1 to 2900)")
+		("no-login", "Keep the sessions connected but not logged in")
+		("match", "Report the allocations of a pairing instead, over --sessions / 2 pairings")
+		("sessionless", "Log in --sessions players without sockets and only report the manager's share, e.g. for a million players");
+
+	po::variables_map vm;
+	try
+	{
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+		po::notify(vm);
+	}
+	catch (const po::error& e)
+	{
+		std::cerr << e.what() << std::endl << desc << std::endl;
+		return 1;
+	}
+	if (vm.count("help"))
+	{
+		std::cout << desc << std::endl;
+		return 0;
+	}
+	const bool sessionless = vm.count("sessionless") > 0;
+	if (sessions == 0 || (!sessionless && sessions > max_sessions))
+	{
+		std::cerr << "The number of sessions should be between 1 and " << max_sessions << " (file descriptor limit)" << std::endl;
+		return 1;
+	}
+	if (ratings == 0 || ratings > 2900)
+	{
+		std::cerr << "The number of ratings should be between 1 and 2900" << std::endl;
+		return 1;
+	}
+	const bool login = vm.count("no-login") == 0;
+	const bool match = vm.count("match") > 0;
+	if (match && (!login || sessions < 2))
+	{
+		std::cerr << "--match needs logged in players and at least 2 sessions" << std::endl;
+		return 1;
+	}
+	if (sessionless && (!login || match))
+	{
+		std::cerr << "--sessionless can't be combined with --no-login or --match" << std::endl;
+		return 1;
+	}
+
+	if (sessionless)
+	{
+		Manager::instance();
+		for (std::size_t i = 0; i < sessions; ++i)
+		{
+			//The player object is part of the session's share, see --no-login
+			const auto player = std::make_shared<Player>();
+			const auto name = "player" + std::to_string(i);
+			Counting counting;
+			Manager::instance().loginPlayer(player, name, "IR", 100 + i % ratings * (2900 / ratings));
+		}
+
+		std::cout << "Players without sessions: " << sessions << " (" << std::min(sessions, ratings)
+			<< (std::min(sessions, ratings) == 1 ? " rating)" : " distinct ratings)") << std::endl;
+		std::cout << "Heap blocks per player:   " << static_cast<double>(live_blocks) / sessions << std::endl;
+		std::cout << "Heap bytes per player:    " << static_cast<double>(live_bytes) / sessions << " requested, "
+			<< static_cast<double>(live_usable + live_blocks * sizeof(std::size_t)) / sessions << " with malloc overhead" << std::endl;
+		return 0;
+	}
+
+	//Static so it outlives the sessions still registered in Manager::instance()
+	static boost::asio::io_context server_io;
+	boost::asio::io_context client_io;
+	tcp::acceptor acceptor(server_io, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+	const auto endpoint = acceptor.local_endpoint();
+
+	//Constructed before counting starts: it's a one-off cost
+	Manager::instance();
+
+	std::vector<tcp::socket> clients;
+	clients.reserve(sessions);
+	boost::asio::streambuf reply;
+
+	if (match)
+	{
+		const auto pairs = sessions / 2;
+		for (std::size_t i = 0; i < pairs; ++i)
+		{
+			for (int j = 0; j < 2; ++j)
+			{
+				clients.emplace_back(client_io);
+				clients.back().connect(endpoint);
+				tcp::socket socket(server_io);
+				acceptor.accept(socket);
+				std::make_shared<PlayerSession>(std::move(socket))->start();
+				const auto request = "login,player" + std::to_string(2 * i + j) + ",IR,1500\n";
+				boost::asio::write(clients.back(), boost::asio::buffer(request));
+			}
+			auto& first  = clients[2 * i];
+			auto& second = clients[2 * i + 1];
+			while (first.available() == 0 || second.available() == 0)
+				server_io.poll();
+			for (auto client : {&first, &second})
+			{
+				boost::asio::read_until(*client, reply, '\n');
+				reply.consume(reply.size());
+			}
+
+			//The reply to the request and the notification of the opponent
+			boost::asio::write(first, boost::asio::buffer("match\n", 6));
+			while (first.available() == 0 || second.available() == 0)
+			{
+				Counting counting;
+				server_io.poll();
+			}
+			for (auto client : {&first, &second})
+			{
+				boost::asio::read_until(*client, reply, '\n');
+				reply.consume(reply.size());
+			}
+		}
+		{
+			Counting counting;
+			server_io.poll();
+		}
+
+		std::cout << "Pairings:                     " << pairs << std::endl;
+		std::cout << "Heap allocations per pairing: " << static_cast<double>(allocations) / pairs << std::endl;
+		std::cout << "Heap bytes per pairing:       " << static_cast<double>(allocated_bytes) / pairs << " requested" << std::endl;
+		std::cout << "Blocks kept per pairing:      " << static_cast<double>(live_blocks) / pairs << std::endl;
+		return 0;
+	}
+
+	const std::size_t batch_size = 256;
+	for (std::size_t first = 0; first < sessions; first += batch_size)
+	{
+		const auto last = std::min(sessions, first + batch_size);
+		for (auto i = first; i < last; ++i)
+		{
+			clients.emplace_back(client_io);
+			clients.back().connect(endpoint);
+		}
+		for (auto i = first; i < last; ++i)
+		{
+			//Accepting registers the socket with the reactor, which is part of the cost
+			Counting counting;
+			tcp::socket socket(server_io);
+			acceptor.accept(socket);
+			std::make_shared<PlayerSession>(std::move(socket))->start();
+		}
+		if (!login)
+			continue;
+
+		for (auto i = first; i < last; ++i)
+		{
+			const auto request = "login,player" + std::to_string(i) + ",IR," + std::to_string(100 + i % ratings * (2900 / ratings)) + "\n";
+			boost::asio::write(clients[i], boost::asio::buffer(request));
+		}
+		//Runs the server until every client has its reply
+		for (auto i = first; i < last;)
+		{
+			{
+				Counting counting;
+				server_io.poll();
+			}
+			for (; i < last && clients[i].available() > 0; ++i)
+			{
+				boost::asio::read_until(clients[i], reply, '\n');
+				reply.consume(reply.size());
+			}
+		}
+	}
+	{
+		Counting counting;
+		server_io.poll();
+	}
+
+	std::cout << "Idle sessions:            " << sessions;
+	if (login)
+		std::cout << " (logged in, " << std::min(sessions, ratings) << (std::min(sessions, ratings) == 1 ? " rating)" : " distinct ratings)") << std::endl;
+	else
+		std::cout << " (not logged in)" << std::endl;
+	std::cout << "sizeof(PlayerSession):    " << sizeof(PlayerSession) << std::endl;
+	std::cout << "Heap blocks per session:  " << static_cast<double>(live_blocks) / sessions << std::endl;
+	std::cout << "Heap bytes per session:   " << static_cast<double>(live_bytes) / sessions << " requested, "
+		<< static_cast<double>(live_usable + live_blocks * sizeof(std::size_t)) / sessions << " with malloc overhead" << std::endl;
+	return 0;
+}
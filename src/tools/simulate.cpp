@@ -0,0 +1,537 @@
+//Runs the manager without sockets to answer capacity questions: players arrive, ask for a
+//match or stay idle, play and log out, following the distributions given on the command line.
+//Timers run on a virtual clock instead of deadline_timer, so an hour of traffic takes seconds
+//and the same seed always gives the same run.
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "server/manager_impl.hpp"
+#include "server/server.hpp"
+
+namespace
+{
+	using SimTime = std::int64_t;	//Microseconds of simulated time
+
+	constexpr SimTime second = 1000000;
+
+	//CPU time of the calling thread: time the simulation spends preempted isn't counted
+	std::int64_t threadCpuNanoseconds()
+	{
+		timespec now;
+		::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+		return static_cast<std::int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+	}
+
+	struct Config
+	{
+		std::uint64_t seed;
+		double duration;		//Seconds
+		double arrival_rate;		//Players per second (Poisson process)
+		double rating_mean;
+		double rating_sd;
+		double match_probability;	//The others stay idle until they log out
+		double regional_probability;	//Match requests that use match,region
+		double think_time;		//Mean seconds between login and match (exponential)
+		double idle_time;		//Mean seconds an idle player stays online (exponential)
+		double game_time;		//Mean seconds a game lasts (exponential)
+		double wait_time;		//Seconds before a match request times out
+		double region_time;		//Seconds before a regional request looks in every region
+		std::vector<double> region_weights;
+	};
+
+	//One country per region, in the order of Region
+	const char* const region_countries[region_count] = {"NG", "IN", "DE", "US", "BR", "AU"};
+
+	enum class Operation {Login, Match, Widen, Logout, Count};
+
+	const char* const operation_names[] = {"login", "match", "widen", "logout"};
+
+	struct Stats
+	{
+		std::uint64_t arrivals = 0;
+		std::size_t online = 0;
+		std::size_t peak_online = 0;
+		std::uint64_t requests = 0;
+		std::uint64_t regional_requests = 0;
+		std::uint64_t pairs = 0;
+		std::uint64_t same_region_pairs = 0;
+		std::uint64_t timeouts = 0;
+		std::vector<float> time_to_match;	//Seconds, one per matched request
+		std::uint64_t calls[static_cast<std::size_t>(Operation::Count)] = {};
+		double call_ns[static_cast<std::size_t>(Operation::Count)] = {};
+	};
+
+	class Simulation;
+
+	//A player driven by the simulation. Its timer is an event of the virtual clock: arming it
+	//again or canceling it changes the generation, which turns the pending event into a no-op.
+	class SimPlayer : public Player, public std::enable_shared_from_this<SimPlayer>
+	{
+	public:
+		enum class State {Idle, Waiting, Playing, Gone};
+
+		SimPlayer(Simulation& sim, std::uint64_t id) : _sim(sim), _id(id) {}
+
+		virtual void waitForAMatch() override;
+		virtual bool waitForARegionalMatch() override;
+		virtual void cancelWaiting() override {++timer_generation;}
+		virtual boost::asio::deadline_timer::duration_type deadline() const override;
+		virtual void paired(const std::shared_ptr<Player>& opponent) override;
+		virtual void opponentLoggedOut(const std::shared_ptr<Player>& /*opponent*/) override {}
+		virtual std::uint64_t sessionId() const override {return _id;}
+
+		State state = State::Idle;
+		SimTime requested_at = -1;	//Time of the pending match request, if any
+		SimTime timer_expiry = 0;
+		std::uint32_t timer_generation = 0;
+		std::uint32_t logout_generation = 0;
+	private:
+		Simulation& _sim;
+		std::uint64_t _id;
+	};
+
+	struct Event
+	{
+		enum class Kind {Arrival, Match, Timeout, Widen, Logout};
+
+		SimTime time;
+		std::uint64_t sequence;		//Keeps events of the same time in scheduling order
+		Kind kind;
+		std::uint32_t generation;
+		std::shared_ptr<SimPlayer> player;
+
+		bool operator>(const Event& other) const
+		{
+			return time != other.time ? time > other.time : sequence > other.sequence;
+		}
+	};
+
+	//Hides which specialization of BasicManager is simulated
+	struct ManagerCalls
+	{
+		std::function<MatchOutcome (const std::shared_ptr<Player>&, const std::string&, const std::string&, std::size_t)> login;
+		std::function<MatchOutcome (const std::shared_ptr<Player>&, bool)> match;
+		std::function<void (const std::shared_ptr<Player>&)> widen;
+		std::function<Status (const std::shared_ptr<Player>&)> logout;
+	};
+
+	template <class ManagerType>
+	ManagerCalls callsOf(ManagerType& manager)
+	{
+		using namespace std::placeholders;
+		return ManagerCalls{std::bind(&ManagerType::loginPlayer, &manager, _1, _2, _3, _4),
+				std::bind(&ManagerType::matchPlayer, &manager, _1, _2),
+				std::bind(&ManagerType::widenMatch, &manager, _1),
+				std::bind(&ManagerType::logoutPlayer, &manager, _1)};
+	}
+
+	class Simulation
+	{
+	public:
+		Simulation(const Config& config, ManagerCalls manager) :
+			_config(config),
+			_manager(std::move(manager)),
+			_rng(config.seed),
+			_rating(config.rating_mean, config.rating_sd),
+			_region(config.region_weights.begin(), config.region_weights.end()),
+			_chance(0.0, 1.0)
+		{
+		}
+
+		void run()
+		{
+			const auto end = toSimTime(_config.duration);
+			schedule(randomDelay(1.0 / _config.arrival_rate), Event::Kind::Arrival, nullptr);
+			while (!_events.empty() && _events.top().time <= end)
+			{
+				const auto event = _events.top();
+				_events.pop();
+				_now = event.time;
+				handle(event);
+			}
+		}
+
+		SimTime now() const {return _now;}
+		const Stats& stats() const {return _stats;}
+
+		void schedule(SimTime delay, Event::Kind kind, std::shared_ptr<SimPlayer> player, std::uint32_t generation = 0)
+		{
+			_events.push(Event{_now + delay, _sequence++, kind, generation, std::move(player)});
+		}
+
+		SimTime waitTime() const {return toSimTime(_config.wait_time);}
+		SimTime regionTime() const {return toSimTime(_config.region_time);}
+
+		//Both players of a pair leave together when the game is over
+		void startGame(const std::shared_ptr<SimPlayer>& player, const std::shared_ptr<SimPlayer>& opponent)
+		{
+			const auto game_over = randomDelay(_config.game_time);
+			++_stats.pairs;
+			_stats.same_region_pairs += regionOf(player->countryCode()) == regionOf(opponent->countryCode());
+			for (const auto& p : {player, opponent})
+			{
+				if (p->requested_at >= 0)
+				{
+					_stats.time_to_match.push_back(static_cast<float>(_now - p->requested_at) / second);
+					p->requested_at = -1;
+				}
+				p->state = SimPlayer::State::Playing;
+				++p->timer_generation;
+				schedule(game_over, Event::Kind::Logout, p, ++p->logout_generation);
+			}
+		}
+	private:
+		static SimTime toSimTime(double seconds) {return static_cast<SimTime>(seconds * second);}
+
+		SimTime randomDelay(double mean)
+		{
+			return toSimTime(std::exponential_distribution<double>(1.0 / mean)(_rng));
+		}
+
+		//Measures the CPU time spent in the manager, which is all the simulation runs of the
+		//server. It includes the players' notifications, which only schedule events here.
+		template <class Call>
+		auto timed(Operation operation, Call call) -> decltype(call())
+		{
+			const auto index = static_cast<std::size_t>(operation);
+			const auto start = threadCpuNanoseconds();
+			auto res = call();
+			_stats.call_ns[index] += threadCpuNanoseconds() - start;
+			++_stats.calls[index];
+			return res;
+		}
+
+		void handle(const Event& event)
+		{
+			const auto& player = event.player;
+			switch (event.kind)
+			{
+				case Event::Kind::Arrival:
+					arrive();
+					schedule(randomDelay(1.0 / _config.arrival_rate), Event::Kind::Arrival, nullptr);
+					break;
+				case Event::Kind::Match:
+					//Unless an idle player was picked as an opponent meanwhile
+					if (player->state == SimPlayer::State::Idle)
+						requestMatch(player);
+					break;
+				case Event::Kind::Timeout:
+					//Players who don't get an opponent give up
+					if (event.generation == player->timer_generation && player->state == SimPlayer::State::Waiting)
+					{
+						++_stats.timeouts;
+						player->requested_at = -1;
+						logout(player);
+					}
+					break;
+				case Event::Kind::Widen:
+					if (event.generation == player->timer_generation && player->state == SimPlayer::State::Waiting)
+						timed(Operation::Widen, [&] {_manager.widen(player); return 0;});
+					break;
+				case Event::Kind::Logout:
+					if (event.generation == player->logout_generation && player->state != SimPlayer::State::Gone)
+						logout(player);
+					break;
+			}
+		}
+
+		void arrive()
+		{
+			const auto id = ++_stats.arrivals;
+			const auto player = std::make_shared<SimPlayer>(*this, id);
+			const auto rating = std::min(std::max(_rating(_rng), 0.0), static_cast<double>(DefaultRatingRange::max_rating));
+			const auto country = region_countries[_region(_rng)];
+			const auto outcome = timed(Operation::Login, [&]
+			{
+				return _manager.login(player, "p" + std::to_string(id), country, static_cast<std::size_t>(rating));
+			});
+			if (outcome.status != Status::Ok)
+				return;
+			_stats.peak_online = std::max(_stats.peak_online, ++_stats.online);
+
+			//Paired with a waiting player while logging in
+			if (player->state == SimPlayer::State::Playing)
+				return;
+			if (_chance(_rng) < _config.match_probability)
+				schedule(randomDelay(_config.think_time), Event::Kind::Match, player);
+			else
+				schedule(randomDelay(_config.idle_time), Event::Kind::Logout, player, ++player->logout_generation);
+		}
+
+		void requestMatch(const std::shared_ptr<SimPlayer>& player)
+		{
+			const bool regional = _chance(_rng) < _config.regional_probability;
+			++_stats.requests;
+			_stats.regional_requests += regional;
+			player->requested_at = _now;
+			player->state = SimPlayer::State::Waiting;
+			timed(Operation::Match, [&] {return _manager.match(player, regional);});
+		}
+
+		void logout(const std::shared_ptr<SimPlayer>& player)
+		{
+			player->state = SimPlayer::State::Gone;
+			++player->timer_generation;
+			timed(Operation::Logout, [&] {return _manager.logout(player);});
+			--_stats.online;
+		}
+
+		Config _config;
+		ManagerCalls _manager;
+		std::mt19937_64 _rng;
+		std::normal_distribution<double> _rating;
+		std::discrete_distribution<std::size_t> _region;
+		std::uniform_real_distribution<double> _chance;
+
+		std::priority_queue<Event, std::vector<Event>, std::greater<Event>> _events;
+		std::uint64_t _sequence = 0;
+		SimTime _now = 0;
+		Stats _stats;
+	};
+
+	void SimPlayer::waitForAMatch()
+	{
+		timer_expiry = _sim.now() + _sim.waitTime();
+		_sim.schedule(_sim.waitTime(), Event::Kind::Timeout, shared_from_this(), ++timer_generation);
+	}
+
+	bool SimPlayer::waitForARegionalMatch()
+	{
+		timer_expiry = _sim.now() + _sim.regionTime();
+		_sim.schedule(_sim.regionTime(), Event::Kind::Widen, shared_from_this(), ++timer_generation);
+		return true;
+	}
+
+	boost::asio::deadline_timer::duration_type SimPlayer::deadline() const
+	{
+		if (state != State::Waiting)
+			return boost::asio::deadline_timer::duration_type();
+		return boost::posix_time::microseconds(timer_expiry - _sim.now());
+	}
+
+	//The manager notifies the player who was waiting or idle, and both players when a regional
+	//request is widened. The requester of a match learns it from the outcome, but starting the
+	//game on the first notification covers both.
+	void SimPlayer::paired(const std::shared_ptr<Player>& opponent)
+	{
+		if (state != State::Playing)
+			_sim.startGame(shared_from_this(), std::static_pointer_cast<SimPlayer>(opponent));
+	}
+
+	double percentile(const std::vector<float>& sorted, double fraction)
+	{
+		if (sorted.empty())
+			return 0;
+		return sorted[std::min(sorted.size() - 1, static_cast<std::size_t>(fraction * sorted.size()))];
+	}
+
+	bool parseWeights(const std::string& text, std::vector<double>& weights)
+	{
+		std::istringstream is(text);
+		std::string token;
+		weights.clear();
+		while (std::getline(is, token, ','))
+		{
+			try
+			{
+				weights.push_back(std::stod(token));
+			}
+			catch (...)
+			{
+				return false;
+			}
+			if (weights.back() < 0)
+				return false;
+		}
+		return weights.size() == region_count && std::any_of(weights.begin(), weights.end(), [](double w) {return w > 0;});
+	}
+
+	void report(const Config& config, const Stats& stats, double real_seconds, double cpu_seconds)
+	{
+		auto times = stats.time_to_match;
+		std::sort(times.begin(), times.end());
+		const auto matched = times.size();
+		const auto ratio = [](double part, double whole) {return whole == 0 ? 0.0 : 100.0 * part / whole;};
+
+		std::cout << "Simulated time:     " << config.duration << " s (seed " << config.seed << ")" << std::endl;
+		std::cout << "Players:            " << stats.arrivals << " arrived, peak online " << stats.peak_online
+			<< ", online at the end " << stats.online << std::endl;
+		std::cout << "Match requests:     " << stats.requests << " (" << stats.regional_requests << " regional), "
+			<< matched << " matched, " << stats.timeouts << " timed out (" << ratio(stats.timeouts, stats.requests) << "%), "
+			<< stats.requests - matched - stats.timeouts << " still waiting" << std::endl;
+		std::cout << "Pairs:              " << stats.pairs << ", " << stats.pairs / config.duration << " per second, "
+			<< ratio(stats.same_region_pairs, stats.pairs) << "% within a region" << std::endl;
+		std::cout << "Time to match (s):  p50 " << percentile(times, 0.5) << ", p90 " << percentile(times, 0.9)
+			<< ", p99 " << percentile(times, 0.99) << ", max " << (times.empty() ? 0 : times.back()) << std::endl;
+		for (std::size_t i = 0; i < static_cast<std::size_t>(Operation::Count); ++i)
+		{
+			std::cout << "Manager " << operation_names[i] << ":" << std::string(11 - std::string(operation_names[i]).size(), ' ')
+				<< stats.calls[i] << " calls, " << (stats.calls[i] == 0 ? 0 : stats.call_ns[i] / stats.calls[i]) << " CPU ns per call" << std::endl;
+		}
+		std::cout << "Run time:           " << real_seconds << " s, " << cpu_seconds << " s CPU, "
+			<< stats.arrivals / real_seconds * 60 << " simulated players per minute" << std::endl;
+	}
+
+	template <class ManagerType>
+	Stats simulate(const Config& config, double& real_seconds, double& cpu_seconds)
+	{
+		//Heap allocated: the rating indexes of some specializations are large
+		auto manager = std::make_unique<ManagerType>();
+		Simulation simulation(config, callsOf(*manager));
+
+		const auto cpu_start = std::clock();
+		const auto start = std::chrono::steady_clock::now();
+		simulation.run();
+		real_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		cpu_seconds = static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+		return simulation.stats();
+	}
+
+	//Every specialization of BasicManager mm-sim can run. The same seed gives every one of them
+	//the same arrivals and choices, so their results can be compared side by side.
+	struct Variant
+	{
+		const char* index;
+		const char* policy;
+		Stats (*simulate)(const Config&, double&, double&);
+	};
+
+	using BucketedIndex = BucketedRatingIndex<DefaultRatingRange::max_rating>;
+
+	const Variant variants[] = {
+		{"tree",     "highest", &simulate<Manager>},
+		{"tree",     "closest", &simulate<BasicManager<TreeRatingIndex, ClosestRatingFirst, DefaultRatingRange>>},
+		{"bucketed", "highest", &simulate<BasicManager<BucketedIndex, HighestRatingFirst, DefaultRatingRange>>},
+		{"bucketed", "closest", &simulate<BasicManager<BucketedIndex, ClosestRatingFirst, DefaultRatingRange>>},
+		{"sorted",   "highest", &simulate<BasicManager<SortedVectorRatingIndex, HighestRatingFirst, DefaultRatingRange>>},
+		{"sorted",   "closest", &simulate<BasicManager<SortedVectorRatingIndex, ClosestRatingFirst, DefaultRatingRange>>}
+	};
+
+	struct Result
+	{
+		const Variant* variant;
+		Stats stats;
+		double real_seconds = 0;
+		double cpu_seconds = 0;
+	};
+
+	//One line per variant: time to match and the time per manager call
+	void compare(const std::vector<Result>& results)
+	{
+		std::cout << "== Comparison (CPU ns per call)" << std::endl;
+		std::cout << std::left << std::setw(10) << "index" << std::setw(9) << "policy" << std::right
+			<< std::setw(9) << "pairs" << std::setw(10) << "p50 (s)" << std::setw(10) << "p99 (s)";
+		for (const auto name : operation_names)
+			std::cout << std::setw(9) << name;
+		std::cout << std::setw(10) << "CPU (s)" << std::endl;
+
+		for (const auto& result : results)
+		{
+			auto times = result.stats.time_to_match;
+			std::sort(times.begin(), times.end());
+			std::cout << std::left << std::setw(10) << result.variant->index << std::setw(9) << result.variant->policy << std::right
+				<< std::setw(9) << result.stats.pairs << std::setw(10) << percentile(times, 0.5) << std::setw(10) << percentile(times, 0.99);
+			for (std::size_t i = 0; i < static_cast<std::size_t>(Operation::Count); ++i)
+			{
+				const auto& stats = result.stats;
+				std::cout << std::setw(9) << static_cast<std::int64_t>(stats.calls[i] == 0 ? 0 : stats.call_ns[i] / stats.calls[i]);
+			}
+			std::cout << std::setw(10) << result.cpu_seconds << std::endl;
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	namespace po = boost::program_options;
+
+	Config config;
+	std::string index, policy, region_weights;
+	po::options_description desc("Options");
+	desc.add_options()
+		("help,h", "Print this help message")
+		("seed", po::value<std::uint64_t>(&config.seed)->default_value(1), "Seed of the random number generator")
+		("duration", po::value<double>(&config.duration)->default_value(3600), "Simulated seconds")
+		("arrival-rate", po::value<double>(&config.arrival_rate)->default_value(1000), "Players logging in per second")
+		("rating-mean", po::value<double>(&config.rating_mean)->default_value(1500), "Mean of the normal rating distribution")
+		("rating-sd", po::value<double>(&config.rating_sd)->default_value(300), "Standard deviation of the rating distribution")
+		("match-probability", po::value<double>(&config.match_probability)->default_value(0.8), "Probability that a player asks for a match")
+		("regional-probability", po::value<double>(&config.regional_probability)->default_value(0), "Probability that a match request is match,region")
+		("think-time", po::value<double>(&config.think_time)->default_value(5), "Mean seconds between login and match")
+		("idle-time", po::value<double>(&config.idle_time)->default_value(600), "Mean seconds a player who doesn't ask for a match stays online")
+		("game-time", po::value<double>(&config.game_time)->default_value(900), "Mean seconds a game lasts")
+		("wait-time", po::value<double>(&config.wait_time)->default_value(wait_timeout), "Seconds before a match request times out")
+		("region-time", po::value<double>(&config.region_time)->default_value(region_timeout), "Seconds before match,region looks in every region")
+		("region-weights", po::value<std::string>(&region_weights)->default_value("15,30,25,20,7,3"),
+			"Relative share of Africa, Asia, Europe, North America, South America and Oceania")
+		("index", po::value<std::string>(&index)->default_value("tree"), "Rating index: tree (the server's), bucketed, sorted or all")
+		("policy", po::value<std::string>(&policy)->default_value("highest"), "Matching policy: highest (the server's), closest or all");
+
+	po::variables_map vm;
+	try
+	{
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+		po::notify(vm);
+	}
+	catch (const po::error& e)
+	{
+		std::cerr << e.what() << std::endl << desc << std::endl;
+		return 1;
+	}
+	if (vm.count("help"))
+	{
+		std::cout << desc << std::endl;
+		return 0;
+	}
+	if (!parseWeights(region_weights, config.region_weights))
+	{
+		std::cerr << "--region-weights should have " << region_count << " non-negative numbers, at least one of them positive" << std::endl;
+		return 1;
+	}
+	if (config.duration <= 0 || config.arrival_rate <= 0 || config.think_time <= 0 || config.idle_time <= 0 ||
+			config.game_time <= 0 || config.wait_time < 0 || config.region_time < 0 || config.rating_sd < 0)
+	{
+		std::cerr << "Durations, rates and the standard deviation should be positive" << std::endl;
+		return 1;
+	}
+
+	std::vector<const Variant*> selected;
+	for (const auto& variant : variants)
+	{
+		if ((index == "all" || index == variant.index) && (policy == "all" || policy == variant.policy))
+			selected.push_back(&variant);
+	}
+	if (selected.empty())
+	{
+		std::cerr << "Unknown index or policy: " << index << ", " << policy << std::endl;
+		return 1;
+	}
+
+	std::vector<Result> results;
+	for (const auto variant : selected)
+	{
+		Result result{variant};
+		result.stats = variant->simulate(config, result.real_seconds, result.cpu_seconds);
+		if (selected.size() > 1)
+			std::cout << "== " << variant->index << " index, " << variant->policy << " policy" << std::endl;
+		report(config, result.stats, result.real_seconds, result.cpu_seconds);
+		results.push_back(std::move(result));
+	}
+	if (results.size() > 1)
+		compare(results);
+	return 0;
+}